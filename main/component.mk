@@ -4,3 +4,10 @@
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
 COMPONENT_ADD_LDFLAGS := $(COMPONENT_ADD_LDFLAGS) -L$(COMPONENT_PATH) -lalgobsec
+
+# Store sizes, the meter_*.c sources stay free of sdkconfig.h
+CFLAGS += -DMETER_STORE_MINUTES=$(CONFIG_METER_STORE_MINUTES) -DMETER_STORE_HOUR_DAYS=$(CONFIG_METER_STORE_HOUR_DAYS) -DMETER_STORE_DAY_MONTHS=$(CONFIG_METER_STORE_DAY_MONTHS)
+
+ifdef CONFIG_UPLOAD_TLS_CA
+COMPONENT_EMBED_TXTFILES := upload_ca.pem
+endif
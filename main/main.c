@@ -15,10 +15,14 @@
 #include <nvs_flash.h>
 
 #include "mod_bme680.h"
+#include "mod_ct.h"
 #include "mod_log.h"
+#include "mod_modbus.h"
 #include "mod_mqtt.h"
 #include "mod_ota.h"
 #include "mod_sntp.h"
+#include "mod_tariff.h"
+#include "mod_upload.h"
 #include "mod_watt_hour_meter.h"
 #include "mod_web_server.h"
 #include "mod_wifi.h"
@@ -42,12 +46,17 @@ void app_main()
     mod_wifi();
     mod_wifi_wait_connected();
     mod_sntp();
-    mod_watt_hour_meter(GPIO_NUM_2);
+    mod_upload();
+    mod_watt_hour_meter();
+    mod_modbus();
+    mod_ct();
     mod_mqtt();
     mod_bme680(GPIO_NUM_0, GPIO_NUM_3);
 
     httpd_handle_t server = mod_webserver_start();
     mod_ota(server);
+    mod_tariff_start(server);
+    mod_ct_start(server);
 
     for (;;) {
         mod_wifi_update();
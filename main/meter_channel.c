@@ -0,0 +1,93 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_channel.h"
+
+void meter_channel_init(meter_channel_t *channel, uint32_t imp_kwh, uint32_t width_min, uint32_t width_max, uint32_t lockout_max, uint32_t demand_interval)
+{
+    memset(channel, 0, sizeof(meter_channel_t));
+    meter_filter_init(&channel->filter, width_min, width_max, lockout_max);
+    meter_power_init(&channel->power, imp_kwh);
+    meter_demand_init(&channel->demand, demand_interval, imp_kwh);
+    meter_forecast_init(&channel->forecast);
+}
+
+void meter_channel_attach(meter_channel_t *channel, meter_store_t *store, meter_event_t *event, meter_load_t *load, int32_t event_threshold)
+{
+    channel->store = store;
+    channel->event = event;
+    channel->load = load;
+    meter_store_init(store);
+    meter_event_init(event, channel->power.imp_kwh, event_threshold);
+    meter_load_init(load, channel->power.imp_kwh);
+}
+
+int meter_channel_edge(meter_channel_t *channel, int64_t time, int level, int64_t *pulse_time)
+{
+    if (level == METER_CHANNEL_MISSED) {
+        uint32_t expected = channel->power.interval_count ? channel->power.interval_sum / channel->power.interval_count : 0;
+        return meter_filter_missed(&channel->filter, time, expected, pulse_time);
+    }
+    return meter_filter_edge(&channel->filter, time, level, pulse_time);
+}
+
+int meter_channel_pulse(meter_channel_t *channel, int64_t time, meter_event_step_t *step)
+{
+    meter_power_pulse(&channel->power, time);
+    return meter_event_pulse(channel->event, time, step);
+}
+
+int32_t meter_channel_count(meter_channel_t *channel, int64_t time, int64_t second, uint32_t count, uint32_t price)
+{
+    int32_t minute = second / 60;
+
+    meter_demand_pulse(&channel->demand, second, count);
+    if (time != 0)
+        meter_load_pulse(channel->load, time, minute);
+    return meter_store_add(channel->store, minute, count, price);
+}
+
+// Before the store moves past the closed hour
+static void meter_channel_forecast(meter_channel_t *channel, int32_t hour)
+{
+    meter_forecast_t *forecast = &channel->forecast;
+    int32_t from = forecast->hour;
+    uint32_t hours[24];
+
+    // After a boot or a step of the clock the profile is learnt again from the last week
+    if (from < 0 || hour - from > 7 * 24) {
+        from = hour - 7 * 24;
+        while (from < hour && meter_store_hours(channel->store, from / 24, hours) == 0)
+            from = (from / 24 + 1) * 24;
+        if (from > hour)
+            from = hour;
+        meter_forecast_init(forecast);
+        meter_forecast_hour(forecast, from, 0);
+    }
+
+    meter_store_hours(channel->store, from / 24, hours);
+    for (int32_t next = from + 1; next <= hour; ++next) {
+        meter_forecast_hour(forecast, next, hours[(next - 1) % 24]);
+        if (next % 24 == 0)
+            meter_store_hours(channel->store, next / 24, hours);
+    }
+}
+
+int meter_channel_advance(meter_channel_t *channel, int64_t time, int64_t second)
+{
+    int32_t minute = second / 60;
+
+    if (minute / 60 > channel->forecast.hour)
+        meter_channel_forecast(channel, minute / 60);
+    meter_store_advance(channel->store, minute);
+    meter_demand_advance(&channel->demand, second);
+    return meter_load_advance(channel->load, time, minute);
+}
@@ -0,0 +1,58 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_CHANNEL_H_
+#define _METER_CHANNEL_H_
+
+#include <stdint.h>
+
+#include "meter_demand.h"
+#include "meter_event.h"
+#include "meter_filter.h"
+#include "meter_forecast.h"
+#include "meter_load.h"
+#include "meter_power.h"
+#include "meter_store.h"
+
+/* The metering path of one channel, from input edges to buckets, with
+   every time passed in by the caller and no locking, clock or allocation
+   of its own, so it runs the same under a fake clock on a host:
+
+   - time   : monotonic us, the esp_timer clock on the device
+   - second : local seconds (days * 86400 + seconds of the day)
+
+   Per input edge meter_channel_edge(), per accepted pulse
+   meter_channel_pulse() and, once the local time is known,
+   meter_channel_count(), then meter_channel_advance() at least once a
+   minute. The store, event and load records are allocated by the caller. */
+
+/* Level of an edge pair merged while interrupts were masked */
+#define METER_CHANNEL_MISSED 2
+
+typedef struct meter_channel {
+    meter_filter_t filter;
+    meter_power_t power;
+    meter_demand_t demand;
+    meter_forecast_t forecast;
+    meter_store_t *store;
+    meter_event_t *event;
+    meter_load_t *load;
+} meter_channel_t;
+
+void meter_channel_init(meter_channel_t *channel, uint32_t imp_kwh, uint32_t width_min, uint32_t width_max, uint32_t lockout_max, uint32_t demand_interval);
+void meter_channel_attach(meter_channel_t *channel, meter_store_t *store, meter_event_t *event, meter_load_t *load, int32_t event_threshold);
+
+int meter_channel_edge(meter_channel_t *channel, int64_t time, int level, int64_t *pulse_time);
+int meter_channel_pulse(meter_channel_t *channel, int64_t time, meter_event_step_t *step);
+/* time is 0 for counts without a pulse time; returns the minute counted in */
+int32_t meter_channel_count(meter_channel_t *channel, int64_t time, int64_t second, uint32_t count, uint32_t price);
+/* Returns 1 when a night closed */
+int meter_channel_advance(meter_channel_t *channel, int64_t time, int64_t second);
+
+#endif
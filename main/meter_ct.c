@@ -0,0 +1,100 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_ct.h"
+
+/* Integer RMS of a CT clamp burst: the first pass takes the mean, which
+   is the bias of the clamp input, the second sums the squares of the
+   samples around it, and an integer square root gives the RMS in 1/256
+   ADC count. A burst spanning whole mains cycles needs no windowing.
+
+   Noise of the ADC and the clamp adds to the RMS even without current,
+   ~1 count on the ESP8266, which reads as ~30 mA and 7 W around the
+   clock at the default calibration. Being uncorrelated with the current
+   it adds in quadrature, so the calibrated noise RMS is taken off the
+   mean square, and currents below current_min are 0.
+
+   The ESP8266 has a single ADC input, so there is no voltage waveform to
+   multiply with: the voltage and the power factor are configured, and
+   the power is Irms * V * PF. */
+
+#define METER_CT_MW_US_WH (3600LL * 1000 * 1000 * 1000)
+
+void meter_ct_init(meter_ct_t *ct, uint32_t ua_count, uint32_t voltage, uint32_t power_factor, uint32_t noise, uint32_t current_min)
+{
+    memset(ct, 0, sizeof(meter_ct_t));
+    ct->ua_count = ua_count;
+    ct->voltage = voltage;
+    ct->power_factor = power_factor;
+    ct->noise = noise * 256 / 100;
+    ct->current_min = current_min;
+}
+
+static uint32_t meter_ct_sqrt(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+void meter_ct_burst(const meter_ct_t *ct, const uint16_t *samples, int count, meter_ct_burst_t *burst)
+{
+    uint32_t sum = 0;
+    uint64_t squares = 0;
+
+    memset(burst, 0, sizeof(meter_ct_burst_t));
+    if (count <= 0 || count > METER_CT_SAMPLES_MAX)
+        return;
+
+    for (int i = 0; i < count; ++i)
+        sum += samples[i];
+    int32_t offset = (int32_t)(((uint64_t)sum << 8) / count);
+
+    // Samples scaled by 256 keep the fraction of the mean
+    for (int i = 0; i < count; ++i) {
+        int32_t delta = ((int32_t)samples[i] << 8) - offset;
+        squares += (uint64_t)((int64_t)delta * delta);
+    }
+
+    uint64_t square = squares / count;
+    uint64_t noise = (uint64_t)ct->noise * ct->noise;
+    burst->offset = offset;
+    burst->rms = meter_ct_sqrt(square);
+    burst->signal = square > noise ? meter_ct_sqrt(square - noise) : 0;
+    burst->current = (uint64_t)burst->signal * ct->ua_count / 256 / 1000;
+    if (burst->current < ct->current_min)
+        burst->current = 0;
+    burst->voltage = ct->voltage;
+    burst->power = (uint64_t)burst->current * ct->voltage * ct->power_factor / 100;
+}
+
+uint32_t meter_ct_energy(meter_ct_t *ct, int32_t power, int64_t interval)
+{
+    if (power <= 0 || interval <= 0)
+        return 0;
+
+    ct->residual += (uint64_t)power * interval;
+    uint32_t wh = ct->residual / METER_CT_MW_US_WH;
+    ct->residual -= (uint64_t)wh * METER_CT_MW_US_WH;
+    return wh;
+}
@@ -0,0 +1,46 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_CT_H_
+#define _METER_CT_H_
+
+#include <stdint.h>
+
+/* Samples of one burst, at most 4096 of a 10-bit ADC */
+#define METER_CT_SAMPLES_MAX 4096
+
+typedef struct meter_ct {
+    // Configuration
+    uint32_t ua_count;
+    uint32_t voltage;
+    uint32_t power_factor;
+    uint32_t noise;
+    uint32_t current_min;
+
+    // Energy not yet whole Wh (mW * us)
+    uint64_t residual;
+} meter_ct_t;
+
+typedef struct meter_ct_burst {
+    uint32_t offset;
+    uint32_t rms;
+    uint32_t signal;
+    uint32_t current;
+    uint32_t voltage;
+    int32_t power;
+} meter_ct_burst_t;
+
+/* noise is the RMS of the input without current in 1/100 count, current_min in mA */
+void meter_ct_init(meter_ct_t *ct, uint32_t ua_count, uint32_t voltage, uint32_t power_factor, uint32_t noise, uint32_t current_min);
+/* offset, rms and signal (rms without the noise) in 1/256 count, current mA, voltage V, power mW */
+void meter_ct_burst(const meter_ct_t *ct, const uint16_t *samples, int count, meter_ct_burst_t *burst);
+/* Whole Wh of power held for the interval (us), the rest is carried over */
+uint32_t meter_ct_energy(meter_ct_t *ct, int32_t power, int64_t interval);
+
+#endif
@@ -0,0 +1,123 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_demand.h"
+#include "meter_time.h"
+
+/* Demand is the average power over a fixed interval, so it is tracked as
+   the pulse count of the open interval. A closed interval is compared with
+   the day and month peaks once, and both the pulse and the close are O(1).
+
+   One pulse is 3.6e9 / imp_kwh mJ, so n pulses over an interval of t s
+   average n * 3.6e9 / (imp_kwh * t) mW. The projection adds the present
+   power over the rest of the interval to the energy already counted. */
+
+#define METER_DEMAND_MJ (3600LL * 1000 * 1000)
+
+static int32_t demand_month(int32_t day)
+{
+    int year, month, mday;
+
+    meter_time_civil(day, &year, &month, &mday);
+    return year * 12 + month - 1;
+}
+
+void meter_demand_init(meter_demand_t *demand, uint32_t interval, uint32_t imp_kwh)
+{
+    memset(demand, 0, sizeof(meter_demand_t));
+    demand->imp_kwh = imp_kwh;
+    demand->interval = interval;
+    demand->start = -1;
+}
+
+void meter_demand_advance(meter_demand_t *demand, int64_t second)
+{
+    int64_t start = second - second % demand->interval;
+
+    if (demand->start < 0) {
+        demand->start = start;
+        demand->day = start / 86400;
+        demand->month = demand_month(demand->day);
+        return;
+    }
+    if (start <= demand->start)
+        return;
+
+    // The finished interval counts towards the day and month it started in
+    if (demand->count > demand->day_peak) {
+        demand->day_peak = demand->count;
+        demand->day_peak_start = demand->start;
+    }
+    if (demand->count > demand->month_peak) {
+        demand->month_peak = demand->count;
+        demand->month_peak_start = demand->start;
+    }
+    demand->count = 0;
+    demand->start = start;
+
+    int32_t day = start / 86400;
+    if (day != demand->day) {
+        demand->day = day;
+        demand->day_peak = 0;
+        demand->day_peak_start = 0;
+
+        int32_t month = demand_month(day);
+        if (month != demand->month) {
+            demand->month = month;
+            demand->month_peak = 0;
+            demand->month_peak_start = 0;
+        }
+    }
+}
+
+void meter_demand_pulse(meter_demand_t *demand, int64_t second, uint32_t count)
+{
+    // A clock stepped backwards counts into the open interval
+    meter_demand_advance(demand, second);
+    demand->count += count;
+}
+
+int32_t meter_demand_power(const meter_demand_t *demand, uint32_t count)
+{
+    if (demand->imp_kwh == 0 || demand->interval == 0)
+        return 0;
+
+    uint64_t power_mw = count * METER_DEMAND_MJ / ((uint64_t)demand->imp_kwh * demand->interval);
+    if (power_mw > INT32_MAX)
+        power_mw = INT32_MAX;
+
+    return (int32_t)power_mw;
+}
+
+int32_t meter_demand_projected(const meter_demand_t *demand, int64_t second, int32_t power)
+{
+    if (demand->imp_kwh == 0 || demand->interval == 0 || demand->start < 0)
+        return 0;
+
+    // Past the open interval nothing was counted yet, so it all comes from power
+    int64_t elapsed = second - demand->start;
+    uint32_t count = demand->count;
+    if (elapsed >= demand->interval) {
+        elapsed = second % demand->interval;
+        count = 0;
+    }
+    if (elapsed < 0)
+        elapsed = 0;
+
+    uint64_t energy = count * METER_DEMAND_MJ / demand->imp_kwh;
+    energy += (uint64_t)(power > 0 ? power : 0) * (demand->interval - elapsed);
+
+    uint64_t power_mw = energy / demand->interval;
+    if (power_mw > INT32_MAX)
+        power_mw = INT32_MAX;
+
+    return (int32_t)power_mw;
+}
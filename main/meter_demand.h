@@ -0,0 +1,37 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_DEMAND_H_
+#define _METER_DEMAND_H_
+
+#include <stdint.h>
+
+/* Times are local seconds (days * 86400 + seconds of the day), so the
+   intervals line up with the local clock */
+typedef struct meter_demand {
+    uint32_t imp_kwh;
+    uint32_t interval;
+    int64_t start;
+    uint32_t count;
+    int32_t day;
+    int32_t month;
+    uint32_t day_peak;
+    int64_t day_peak_start;
+    uint32_t month_peak;
+    int64_t month_peak_start;
+} meter_demand_t;
+
+void meter_demand_init(meter_demand_t *demand, uint32_t interval, uint32_t imp_kwh);
+void meter_demand_advance(meter_demand_t *demand, int64_t second);
+void meter_demand_pulse(meter_demand_t *demand, int64_t second, uint32_t count);
+
+int32_t meter_demand_power(const meter_demand_t *demand, uint32_t count);
+int32_t meter_demand_projected(const meter_demand_t *demand, int64_t second, int32_t power);
+
+#endif
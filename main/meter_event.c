@@ -0,0 +1,102 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_event.h"
+
+/* Step detector over the last pulse intervals. Two adjacent windows of
+   METER_EVENT_WINDOW intervals are kept as running sums, so each pulse
+   moves one interval from the newer window into the older one and drops
+   one from the older window: O(1) per pulse in fixed memory.
+
+   n pulses over t ms average n * 3.6e12 / (imp_kwh * t) mW. A clean
+   load step makes the difference of the window averages grow until the
+   newer window holds only the new level and shrink after, so the step
+   is reported at its peak, timed at the first pulse of the newer window.
+   The detector then holds off for one window so a step is reported once. */
+
+#define METER_EVENT_MW_MS (3600LL * 1000 * 1000 * 1000)
+
+_Static_assert((METER_EVENT_HISTORY & (METER_EVENT_HISTORY - 1)) == 0, "METER_EVENT_HISTORY must be a power of two");
+
+void meter_event_init(meter_event_t *event, uint32_t imp_kwh, int32_t threshold)
+{
+    memset(event, 0, sizeof(meter_event_t));
+    event->imp_kwh = imp_kwh;
+    event->threshold = threshold;
+}
+
+static int32_t event_power(const meter_event_t *event, uint32_t sum)
+{
+    return METER_EVENT_WINDOW * METER_EVENT_MW_MS / ((int64_t)event->imp_kwh * sum);
+}
+
+int meter_event_pulse(meter_event_t *event, int64_t time, meter_event_step_t *step)
+{
+    if (event->pulse_time == 0 || event->imp_kwh == 0) {
+        event->pulse_time = time;
+        return 0;
+    }
+
+    int64_t interval = (time - event->pulse_time) / 1000;
+    if (interval > UINT16_MAX)
+        interval = UINT16_MAX;
+    if (interval < 1)
+        interval = 1;
+    event->pulse_time = time;
+
+    // Newest interval at count - 1
+    event->intervals[event->count % METER_EVENT_HISTORY] = (uint16_t)interval;
+    event->count++;
+    event->sum_after += (uint32_t)interval;
+    if (event->count > METER_EVENT_WINDOW) {
+        uint16_t moved = event->intervals[(event->count - 1 - METER_EVENT_WINDOW) % METER_EVENT_HISTORY];
+        event->sum_after -= moved;
+        event->sum_before += moved;
+    }
+    if (event->count > METER_EVENT_WINDOW * 2)
+        event->sum_before -= event->intervals[(event->count - 1 - METER_EVENT_WINDOW * 2) % METER_EVENT_HISTORY];
+    if (event->count < METER_EVENT_WINDOW * 2)
+        return 0;
+
+    if (event->holdoff) {
+        event->holdoff--;
+        return 0;
+    }
+
+    int32_t delta = event_power(event, event->sum_after) - event_power(event, event->sum_before);
+    int32_t magnitude = delta < 0 ? -delta : delta;
+    int32_t peak = event->peak < 0 ? -event->peak : event->peak;
+
+    if (magnitude >= event->threshold && magnitude > peak && (event->peak == 0 || (delta < 0) == (event->peak < 0))) {
+        event->peak = delta;
+        event->peak_time = time - (int64_t)event->sum_after * 1000;
+        return 0;
+    }
+    if (event->peak == 0)
+        return 0;
+
+    step->time = event->peak_time;
+    step->delta = event->peak;
+    event->log[event->steps % METER_EVENT_LOG] = *step;
+    event->steps++;
+    event->peak = 0;
+    event->holdoff = METER_EVENT_WINDOW;
+
+    return 1;
+}
+
+const meter_event_step_t *meter_event_step(const meter_event_t *event, uint32_t age)
+{
+    if (age >= event->steps || age >= METER_EVENT_LOG)
+        return NULL;
+
+    return &event->log[(event->steps - 1 - age) % METER_EVENT_LOG];
+}
@@ -0,0 +1,48 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_EVENT_H_
+#define _METER_EVENT_H_
+
+#include <stdint.h>
+
+#define METER_EVENT_WINDOW  8
+#define METER_EVENT_HISTORY (2 * METER_EVENT_WINDOW)
+#define METER_EVENT_LOG     16
+
+typedef struct meter_event_step {
+    int64_t time;
+    int32_t delta;
+} meter_event_step_t;
+
+typedef struct meter_event {
+    uint32_t imp_kwh;
+    int32_t threshold;
+    int64_t pulse_time;
+    uint32_t count;
+    uint32_t sum_before;
+    uint32_t sum_after;
+    int32_t peak;
+    int64_t peak_time;
+    int holdoff;
+
+    // Detected steps, newest at (steps - 1) % METER_EVENT_LOG
+    uint32_t steps;
+    meter_event_step_t log[METER_EVENT_LOG];
+
+    // Inter-pulse intervals of both windows in ms, saturated at 65535
+    uint16_t intervals[METER_EVENT_HISTORY];
+} meter_event_t;
+
+void meter_event_init(meter_event_t *event, uint32_t imp_kwh, int32_t threshold);
+int meter_event_pulse(meter_event_t *event, int64_t time, meter_event_step_t *step);
+
+const meter_event_step_t *meter_event_step(const meter_event_t *event, uint32_t age);
+
+#endif
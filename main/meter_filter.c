@@ -0,0 +1,141 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_filter.h"
+
+/* The meter LED pulls the input low for the duration of a pulse:
+   a falling edge opens a pulse and the following rising edge closes it.
+
+   A pulse is accepted when
+   - its width lies inside [width_min, width_max], and
+   - its leading edge is at least the lockout after the previous accepted pulse.
+
+   The lockout follows a quarter of the smoothed inter-pulse interval, bounded
+   below by twice width_min and above by lockout_max (the old fixed debounce).
+   The interval average drops quickly and rises slowly, and pulses that fail
+   only the lockout still feed it, so a real load step is tracked after one or
+   two pulses while isolated glitches stay rejected. */
+
+void meter_filter_init(meter_filter_t *filter, uint32_t width_min, uint32_t width_max, uint32_t lockout_max)
+{
+    memset(filter, 0, sizeof(meter_filter_t));
+    filter->width_min = width_min;
+    filter->width_max = width_max;
+    filter->lockout_max = lockout_max;
+    filter->interval = lockout_max * 4;
+}
+
+uint32_t meter_filter_lockout(const meter_filter_t *filter)
+{
+    uint32_t lockout = filter->interval / 4;
+
+    if (lockout > filter->lockout_max)
+        lockout = filter->lockout_max;
+    if (lockout < filter->width_min * 2)
+        lockout = filter->width_min * 2;
+
+    return lockout;
+}
+
+static void meter_filter_interval(meter_filter_t *filter, int64_t interval)
+{
+    // Long idle gaps would only slow down the recovery
+    if (interval > (int64_t)filter->lockout_max * 16)
+        interval = (int64_t)filter->lockout_max * 16;
+
+    if (interval < filter->interval)
+        filter->interval -= (filter->interval - (uint32_t)interval) / 2;
+    else
+        filter->interval += ((uint32_t)interval - filter->interval) / 8;
+}
+
+static void meter_filter_histogram(meter_filter_t *filter, uint32_t width)
+{
+    int bin = 0;
+
+    if (width != 0)
+        bin = 31 - __builtin_clz(width) - 8;
+    if (bin < 0)
+        bin = 0;
+    if (bin >= METER_FILTER_HISTOGRAM)
+        bin = METER_FILTER_HISTOGRAM - 1;
+
+    filter->width_histogram[bin]++;
+}
+
+int meter_filter_edge(meter_filter_t *filter, int64_t time, int level, int64_t *pulse_time)
+{
+    // Leading edge
+    if (level == 0) {
+        if (filter->edge_pending)
+            filter->rejected_edge++;
+        filter->edge_time = time;
+        filter->edge_pending = 1;
+        return 0;
+    }
+
+    // Trailing edge
+    if (filter->edge_pending == 0) {
+        filter->rejected_edge++;
+        return 0;
+    }
+    filter->edge_pending = 0;
+
+    int64_t width = time - filter->edge_time;
+    if (width > UINT32_MAX)
+        width = UINT32_MAX;
+    meter_filter_histogram(filter, (uint32_t)width);
+    if (width < filter->width_min || width > filter->width_max) {
+        filter->rejected_width++;
+        return 0;
+    }
+
+    if (filter->pulse_time != 0) {
+        int64_t interval = filter->edge_time - filter->pulse_time;
+        uint32_t lockout = meter_filter_lockout(filter);
+
+        meter_filter_interval(filter, interval);
+        if (interval < lockout) {
+            filter->rejected_lockout++;
+            return 0;
+        }
+    }
+
+    filter->pulse_time = filter->edge_time;
+    *pulse_time = filter->edge_time;
+    return 1;
+}
+
+/* The closing edges of a pulse were merged into one interrupt while
+   interrupts were masked, e.g. by a flash write, so only the level after
+   them is known. Its width can't be checked, so the pulse is only counted
+   when the gap since the last one lies within half and twice the expected
+   interval, the average the caller keeps of the recent pulses (0 when
+   unknown). Anything else is dropped as a glitch. */
+int meter_filter_missed(meter_filter_t *filter, int64_t time, uint32_t expected, int64_t *pulse_time)
+{
+    // A seen leading edge dates the pulse better than the interrupt
+    if (filter->edge_pending) {
+        filter->edge_pending = 0;
+        time = filter->edge_time;
+    }
+
+    int64_t interval = time - filter->pulse_time;
+    if (filter->pulse_time == 0 || expected == 0 || interval < expected / 2 || interval > (int64_t)expected * 2) {
+        filter->rejected_missed++;
+        return 0;
+    }
+    meter_filter_interval(filter, interval);
+
+    filter->pulse_time = time;
+    *pulse_time = time;
+    return 1;
+}
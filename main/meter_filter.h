@@ -0,0 +1,44 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_FILTER_H_
+#define _METER_FILTER_H_
+
+#include <stdint.h>
+
+/* Width histogram bin b counts widths in [2^(b+8), 2^(b+9)) us,
+   with the first and last bins open ended */
+#define METER_FILTER_HISTOGRAM 12
+
+typedef struct meter_filter {
+    // Configuration (us)
+    uint32_t width_min;
+    uint32_t width_max;
+    uint32_t lockout_max;
+
+    // State
+    int64_t edge_time;
+    int64_t pulse_time;
+    uint32_t interval;
+    int edge_pending;
+
+    // Statistics
+    uint32_t rejected_edge;
+    uint32_t rejected_width;
+    uint32_t rejected_lockout;
+    uint32_t rejected_missed;
+    uint32_t width_histogram[METER_FILTER_HISTOGRAM];
+} meter_filter_t;
+
+void meter_filter_init(meter_filter_t *filter, uint32_t width_min, uint32_t width_max, uint32_t lockout_max);
+int meter_filter_edge(meter_filter_t *filter, int64_t time, int level, int64_t *pulse_time);
+int meter_filter_missed(meter_filter_t *filter, int64_t time, uint32_t expected, int64_t *pulse_time);
+uint32_t meter_filter_lockout(const meter_filter_t *filter);
+
+#endif
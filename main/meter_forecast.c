@@ -0,0 +1,80 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_forecast.h"
+
+/* Each closed hour moves its profile bucket 1/8 of the way to its count,
+   and the first count of a bucket is taken as is. The sum of the profile
+   and the sum of the hours after the open one are kept along, so a closed
+   hour and a forecast are both O(1); only a step over several hours sums
+   the rest of the day again.
+
+   Day   = pulses so far + rest of the open hour + profile of the later hours
+   Month = pulses so far + rest of the day + days left * profile of a day */
+
+void meter_forecast_init(meter_forecast_t *forecast)
+{
+    memset(forecast, 0, sizeof(meter_forecast_t));
+    forecast->hour = -1;
+}
+
+void meter_forecast_hour(meter_forecast_t *forecast, int32_t hour, uint32_t count)
+{
+    if (hour <= forecast->hour)
+        return;
+
+    // Learn the closed hour
+    if (forecast->hour >= 0) {
+        int index = forecast->hour % 24;
+        uint32_t old = forecast->profile[index];
+        uint32_t sample = count << METER_FORECAST_SCALE;
+
+        if (forecast->learnt & (1u << index))
+            forecast->profile[index] = old + ((int32_t)(sample - old) >> METER_FORECAST_WEIGHT);
+        else
+            forecast->profile[index] = sample;
+        forecast->learnt |= 1u << index;
+        forecast->total += forecast->profile[index] - old;
+    }
+
+    // Open the next one
+    int index = hour % 24;
+    if (hour == forecast->hour + 1 && index != 0) {
+        forecast->rest -= forecast->profile[index];
+    } else {
+        forecast->rest = 0;
+        for (int i = index + 1; i < 24; ++i)
+            forecast->rest += forecast->profile[i];
+    }
+    forecast->hour = hour;
+}
+
+uint32_t meter_forecast_day(const meter_forecast_t *forecast, uint32_t day, int minute)
+{
+    if (forecast->hour < 0)
+        return day;
+
+    uint32_t open = forecast->profile[forecast->hour % 24];
+    uint32_t left = open - (uint64_t)open * minute / 60;
+
+    return day + ((left + forecast->rest) >> METER_FORECAST_SCALE);
+}
+
+/* days: whole days of the month after the open one */
+uint32_t meter_forecast_month(const meter_forecast_t *forecast, uint32_t month, uint32_t day, int minute, int days)
+{
+    if (forecast->hour < 0)
+        return month;
+
+    uint64_t left = (uint64_t)forecast->total * days >> METER_FORECAST_SCALE;
+
+    return month + (meter_forecast_day(forecast, day, minute) - day) + (uint32_t)left;
+}
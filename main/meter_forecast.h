@@ -0,0 +1,35 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_FORECAST_H_
+#define _METER_FORECAST_H_
+
+#include <stdint.h>
+
+/* Pulses of each hour of the day, exponentially weighted over the previous
+   days, in 1/16 pulse */
+#define METER_FORECAST_SCALE 4
+#define METER_FORECAST_WEIGHT 3
+
+typedef struct meter_forecast {
+    uint32_t profile[24];
+    uint32_t learnt;
+    uint32_t total;
+    uint32_t rest;
+    int32_t hour;
+} meter_forecast_t;
+
+void meter_forecast_init(meter_forecast_t *forecast);
+/* Closes the open hour with its pulses and opens the local hour index */
+void meter_forecast_hour(meter_forecast_t *forecast, int32_t hour, uint32_t count);
+
+uint32_t meter_forecast_day(const meter_forecast_t *forecast, uint32_t day, int minute);
+uint32_t meter_forecast_month(const meter_forecast_t *forecast, uint32_t month, uint32_t day, int minute, int days);
+
+#endif
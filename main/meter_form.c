@@ -0,0 +1,145 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "meter_form.h"
+
+/* Request body written through a small buffer, so a body of any size is
+   built without allocating. Running the same fields without a sink gives
+   the Content-Length first. The field functions encode
+   application/x-www-form-urlencoded, the raw writers below serve the
+   line protocol and JSON bodies. */
+
+static void form_flush(meter_form_t *form)
+{
+    if (form->sink && form->used && form->error == 0) {
+        if (form->sink(form->context, form->buffer, form->used) != form->used)
+            form->error = 1;
+    }
+    form->used = 0;
+}
+
+static void form_char(meter_form_t *form, char c)
+{
+    if (form->used == METER_FORM_BUFFER)
+        form_flush(form);
+    form->buffer[form->used++] = c;
+    form->length++;
+}
+
+static void form_key(meter_form_t *form, const char *key)
+{
+    if (form->fields++)
+        form_char(form, '&');
+    while (*key)
+        form_char(form, *key++);
+}
+
+void meter_form_init(meter_form_t *form, meter_form_sink_t sink, void *context)
+{
+    form->sink = sink;
+    form->context = context;
+    form->length = 0;
+    form->used = 0;
+    form->fields = 0;
+    form->error = 0;
+}
+
+void meter_form_string(meter_form_t *form, const char *key, const char *value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    form_key(form, key);
+    for (; *value; ++value) {
+        unsigned char c = *value;
+        if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+            c == '-' || c == '.' || c == '_' || c == '~') {
+            form_char(form, c);
+        } else if (c == ' ') {
+            form_char(form, '+');
+        } else {
+            form_char(form, '%');
+            form_char(form, hex[c >> 4]);
+            form_char(form, hex[c & 15]);
+        }
+    }
+}
+
+static void form_digits(meter_form_t *form, uint64_t value, int decimals)
+{
+    char digits[20];
+    int count = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value || count <= decimals);
+    while (count) {
+        if (count-- == decimals)
+            form_char(form, '.');
+        form_char(form, digits[count]);
+    }
+}
+
+void meter_form_uint(meter_form_t *form, const char *key, uint32_t value)
+{
+    form_key(form, key);
+    form_digits(form, value, 0);
+}
+
+void meter_form_text(meter_form_t *form, const char *text)
+{
+    while (*text)
+        form_char(form, *text++);
+}
+
+void meter_form_decimal(meter_form_t *form, int64_t value, int decimals)
+{
+    if (value < 0) {
+        form_char(form, '-');
+        value = -value;
+    }
+    form_digits(form, value, decimals);
+}
+
+void meter_form_json(meter_form_t *form, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    form_char(form, '"');
+    for (; *text; ++text) {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\') {
+            form_char(form, '\\');
+            form_char(form, c);
+        } else if (c < 0x20) {
+            meter_form_text(form, "\\u00");
+            form_char(form, hex[c >> 4]);
+            form_char(form, hex[c & 15]);
+        } else {
+            form_char(form, c);
+        }
+    }
+    form_char(form, '"');
+}
+
+void meter_form_tag(meter_form_t *form, const char *text)
+{
+    for (; *text; ++text) {
+        if (*text == ',' || *text == ' ' || *text == '=')
+            form_char(form, '\\');
+        form_char(form, *text);
+    }
+}
+
+int32_t meter_form_finish(meter_form_t *form)
+{
+    form_flush(form);
+    return form->error ? -1 : (int32_t)form->length;
+}
@@ -0,0 +1,48 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#ifndef _METER_FORM_H_
+#define _METER_FORM_H_
+
+#include <stdint.h>
+
+#ifndef METER_FORM_BUFFER
+#define METER_FORM_BUFFER 64
+#endif
+
+/* Receives the encoded bytes, returns the count written or < 0 on error */
+typedef int (*meter_form_sink_t)(void *context, const char *data, int length);
+
+typedef struct meter_form {
+    meter_form_sink_t sink;
+    void *context;
+    uint32_t length;
+    uint16_t used;
+    uint8_t fields;
+    uint8_t error;
+    char buffer[METER_FORM_BUFFER];
+} meter_form_t;
+
+/* Without a sink only the length is counted */
+void meter_form_init(meter_form_t *form, meter_form_sink_t sink, void *context);
+/* The key is written as is and carries its '=', the value is percent-encoded */
+void meter_form_string(meter_form_t *form, const char *key, const char *value);
+void meter_form_uint(meter_form_t *form, const char *key, uint32_t value);
+
+/* Raw writers for the other body formats */
+void meter_form_text(meter_form_t *form, const char *text);
+/* value / 10^decimals, e.g. (2153, 2) is "21.53" */
+void meter_form_decimal(meter_form_t *form, int64_t value, int decimals);
+/* A quoted JSON string */
+void meter_form_json(meter_form_t *form, const char *text);
+/* An InfluxDB tag value, with commas, spaces and '=' escaped */
+void meter_form_tag(meter_form_t *form, const char *text);
+/* Returns the encoded length or -1 when the sink failed */
+int32_t meter_form_finish(meter_form_t *form);
+
+#endif
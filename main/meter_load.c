@@ -0,0 +1,132 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_load.h"
+#include "meter_time.h"
+
+/* Load-duration histograms: every pulse closes an interval of known mean
+   power, and the length of the interval is added to the bin of that power
+   in the histograms of the day, the month and the night, so a pulse costs
+   one division and three adds.
+
+   The base load is the 5th percentile of the night histogram, taken when
+   the night ends. Before that, the time since the last pulse is credited
+   to the night at the power it implies at most, so a quiet night still
+   counts as one; the next pulse only adds the time after the credit. */
+
+#define METER_LOAD_OCTAVE 3
+#define METER_LOAD_MW_US (3600LL * 1000 * 1000 * 1000 * 1000)
+
+void meter_load_init(meter_load_t *load, uint32_t imp_kwh)
+{
+    memset(load, 0, sizeof(meter_load_t));
+    load->imp_kwh = imp_kwh;
+    load->day = -1;
+}
+
+static int meter_load_bin(uint32_t power)
+{
+    uint32_t watt = power / 1000;
+
+    if (watt < (1u << METER_LOAD_OCTAVE))
+        return 0;
+
+    int octave = 31 - __builtin_clz(watt);
+    int bin = 1 + (octave - METER_LOAD_OCTAVE) * 4 + ((watt >> (octave - 2)) & 3);
+    if (bin >= METER_LOAD_BINS)
+        bin = METER_LOAD_BINS - 1;
+    return bin;
+}
+
+uint32_t meter_load_power(int bin)
+{
+    if (bin <= 0)
+        return 0;
+
+    int octave = (bin - 1) / 4 + METER_LOAD_OCTAVE;
+    return ((4u + (bin - 1) % 4) << (octave - 2)) * 1000;
+}
+
+uint32_t meter_load_percentile(const uint32_t bins[METER_LOAD_BINS], int percent)
+{
+    uint64_t total = 0;
+    uint64_t sum = 0;
+
+    for (int i = 0; i < METER_LOAD_BINS; ++i)
+        total += bins[i];
+    if (total == 0)
+        return 0;
+
+    for (int i = 0; i < METER_LOAD_BINS; ++i) {
+        sum += bins[i];
+        if (sum * 100 >= total * percent)
+            return meter_load_power(i);
+    }
+    return meter_load_power(METER_LOAD_BINS - 1);
+}
+
+static void meter_load_add(meter_load_t *load, int64_t time, int64_t from)
+{
+    int64_t interval = time - load->pulse_time;
+    uint32_t power = UINT32_MAX;
+
+    if (interval > 0 && METER_LOAD_MW_US / interval / load->imp_kwh < UINT32_MAX)
+        power = METER_LOAD_MW_US / interval / load->imp_kwh;
+
+    int bin = meter_load_bin(power);
+    uint32_t ms = (time - from) / 1000;
+    load->day_ms[bin] += ms;
+    load->month_ms[bin] += ms;
+    if (load->night)
+        load->night_ms[bin] += ms;
+}
+
+int meter_load_advance(meter_load_t *load, int64_t time, int32_t minute)
+{
+    int32_t day = minute / 1440;
+
+    if (day != load->day) {
+        int year, month, mday;
+        meter_time_civil(day, &year, &month, &mday);
+        if (year * 12 + month != load->month)
+            memset(load->month_ms, 0, sizeof(load->month_ms));
+        memset(load->day_ms, 0, sizeof(load->day_ms));
+        memset(load->night_ms, 0, sizeof(load->night_ms));
+        load->day = day;
+        load->month = year * 12 + month;
+        load->night = minute % 1440 < METER_LOAD_NIGHT;
+        return 0;
+    }
+
+    if (load->night == 0 || minute % 1440 < METER_LOAD_NIGHT)
+        return 0;
+
+    // Close the night
+    if (load->pulse_time != 0) {
+        int64_t from = load->credit_time > load->pulse_time ? load->credit_time : load->pulse_time;
+        meter_load_add(load, time, from);
+        load->credit_time = time;
+    }
+    load->night = 0;
+    load->base = meter_load_percentile(load->night_ms, METER_LOAD_PERCENTILE);
+    return 1;
+}
+
+void meter_load_pulse(meter_load_t *load, int64_t time, int32_t minute)
+{
+    meter_load_advance(load, time, minute);
+
+    if (load->pulse_time != 0 && time > load->pulse_time) {
+        int64_t from = load->credit_time > load->pulse_time ? load->credit_time : load->pulse_time;
+        meter_load_add(load, time, from);
+    }
+    load->pulse_time = time;
+}
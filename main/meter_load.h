@@ -0,0 +1,44 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_LOAD_H_
+#define _METER_LOAD_H_
+
+#include <stdint.h>
+
+/* Bin 0 is below 8 W, then 4 bins per octave up to 32 kW and over */
+#define METER_LOAD_BINS 49
+/* The night runs from midnight to 05:00 local time */
+#define METER_LOAD_NIGHT 300
+#define METER_LOAD_PERCENTILE 5
+
+typedef struct meter_load {
+    uint32_t imp_kwh;
+    int64_t pulse_time;
+    int64_t credit_time;
+    int32_t day;
+    int32_t month;
+    int night;
+    uint32_t base;
+
+    // Time spent in each power bin (ms)
+    uint32_t day_ms[METER_LOAD_BINS];
+    uint32_t month_ms[METER_LOAD_BINS];
+    uint32_t night_ms[METER_LOAD_BINS];
+} meter_load_t;
+
+void meter_load_init(meter_load_t *load, uint32_t imp_kwh);
+/* Times are esp_timer us, minutes local minute indexes; returns 1 when a night closed */
+int meter_load_advance(meter_load_t *load, int64_t time, int32_t minute);
+void meter_load_pulse(meter_load_t *load, int64_t time, int32_t minute);
+
+uint32_t meter_load_power(int bin);
+uint32_t meter_load_percentile(const uint32_t bins[METER_LOAD_BINS], int percent);
+
+#endif
@@ -0,0 +1,183 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "meter_modbus.h"
+
+/* Modbus RTU master framing for SDM-style meters, whose readings are
+   32-bit floats in pairs of input registers (function 0x04), high word
+   first. The register map is sorted by address and cut into batches:
+   an entry joins the previous batch while the gap to it is at most
+   METER_MODBUS_GAP registers and the batch stays within
+   METER_MODBUS_BATCH. At 9600 baud a read costs ~10 ms of framing and
+   turnaround against ~2 ms per skipped register, so bridging short gaps
+   is cheaper than another request. */
+
+uint16_t meter_modbus_crc(const uint8_t *data, int length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (int i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+static int meter_modbus_compare(const void *a, const void *b)
+{
+    const meter_modbus_register_t *left = a;
+    const meter_modbus_register_t *right = b;
+
+    return (int)left->address - (int)right->address;
+}
+
+int meter_modbus_parse(meter_modbus_t *modbus, uint8_t slave, const char *map)
+{
+    memset(modbus, 0, sizeof(meter_modbus_t));
+    modbus->slave = slave;
+
+    while (*map != 0) {
+        if (modbus->count >= METER_MODBUS_REGISTERS)
+            return -1;
+
+        meter_modbus_register_t *reg = &modbus->registers[modbus->count];
+        int length = 0;
+        while (*map != 0 && *map != ':') {
+            if (length >= (int)sizeof(reg->name) - 1)
+                return -1;
+            reg->name[length++] = *map++;
+        }
+        if (*map != ':' || length == 0)
+            return -1;
+        map++;
+
+        char *end;
+        long address = strtol(map, &end, 0);
+        if (end == map || address < 0 || address > 0xFFFE)
+            return -1;
+        reg->address = address;
+        modbus->count++;
+
+        map = end;
+        if (*map == ',')
+            map++;
+        else if (*map != 0)
+            return -1;
+    }
+    if (modbus->count == 0)
+        return -1;
+
+    qsort(modbus->registers, modbus->count, sizeof(meter_modbus_register_t), meter_modbus_compare);
+
+    // Batches
+    meter_modbus_batch_t *batch = NULL;
+    for (int i = 0; i < modbus->count; ++i) {
+        uint16_t address = modbus->registers[i].address;
+        if (batch && address <= batch->address + batch->count + METER_MODBUS_GAP &&
+            address + 2 - batch->address <= METER_MODBUS_BATCH) {
+            if (address + 2 - batch->address > batch->count)
+                batch->count = address + 2 - batch->address;
+            continue;
+        }
+        batch = &modbus->batches[modbus->batch_count++];
+        batch->address = address;
+        batch->count = 2;
+    }
+
+    return 0;
+}
+
+int meter_modbus_find(const meter_modbus_t *modbus, const char *name)
+{
+    for (int i = 0; i < modbus->count; ++i) {
+        if (strcmp(modbus->registers[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int meter_modbus_request(const meter_modbus_t *modbus, int batch, uint8_t frame[8])
+{
+    const meter_modbus_batch_t *b = &modbus->batches[batch];
+
+    frame[0] = modbus->slave;
+    frame[1] = 0x04;
+    frame[2] = b->address >> 8;
+    frame[3] = b->address & 0xFF;
+    frame[4] = b->count >> 8;
+    frame[5] = b->count & 0xFF;
+
+    uint16_t crc = meter_modbus_crc(frame, 6);
+    frame[6] = crc & 0xFF;
+    frame[7] = crc >> 8;
+    return 8;
+}
+
+int meter_modbus_response_length(const meter_modbus_t *modbus, int batch)
+{
+    return 5 + 2 * modbus->batches[batch].count;
+}
+
+int meter_modbus_response(meter_modbus_t *modbus, int batch, const uint8_t *frame, int length)
+{
+    const meter_modbus_batch_t *b = &modbus->batches[batch];
+
+    // An exception response is 5 bytes, checked like any other
+    if (length < 5)
+        return METER_MODBUS_FORMAT;
+    if (frame[1] == (0x04 | 0x80))
+        length = 5;
+    uint16_t crc = meter_modbus_crc(frame, length - 2);
+    if (frame[length - 2] != (crc & 0xFF) || frame[length - 1] != (crc >> 8))
+        return METER_MODBUS_CRC;
+    if (frame[0] != modbus->slave)
+        return METER_MODBUS_FORMAT;
+    if (frame[1] != 0x04)
+        return METER_MODBUS_EXCEPTION;
+    if (frame[2] != 2 * b->count || length != meter_modbus_response_length(modbus, batch))
+        return METER_MODBUS_FORMAT;
+
+    for (int i = 0; i < modbus->count; ++i) {
+        meter_modbus_register_t *reg = &modbus->registers[i];
+        if (reg->address < b->address || reg->address + 2 > b->address + b->count)
+            continue;
+        const uint8_t *data = &frame[3 + 2 * (reg->address - b->address)];
+        uint32_t bits = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+        reg->value = meter_modbus_milli(bits);
+    }
+
+    return METER_MODBUS_OK;
+}
+
+int32_t meter_modbus_milli(uint32_t bits)
+{
+    int exponent = (bits >> 23) & 0xFF;
+    int64_t mantissa = bits & 0x7FFFFF;
+
+    // Zero, denormals, and NaN or infinity clamped below
+    if (exponent == 0)
+        return 0;
+    mantissa |= 0x800000;
+
+    // value = mantissa * 2^(exponent - 150)
+    int shift = exponent - 150;
+    int64_t value = mantissa * 1000;
+    if (shift >= 0)
+        value = shift > 16 ? INT32_MAX : value << shift;
+    else
+        value = shift < -40 ? 0 : (value + (1LL << (-shift - 1))) >> -shift;
+    if (value > INT32_MAX)
+        value = INT32_MAX;
+
+    return (bits & 0x80000000) ? -(int32_t)value : (int32_t)value;
+}
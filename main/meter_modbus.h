@@ -0,0 +1,61 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_MODBUS_H_
+#define _METER_MODBUS_H_
+
+#include <stdint.h>
+
+#define METER_MODBUS_REGISTERS 8
+/* Registers read in between two map entries rather than starting a new read */
+#define METER_MODBUS_GAP 16
+/* Registers per read, a response then fits in 5 + 2 * 60 bytes */
+#define METER_MODBUS_BATCH 60
+#define METER_MODBUS_FRAME (5 + 2 * METER_MODBUS_BATCH)
+
+typedef struct meter_modbus_register {
+    char name[12];
+    uint16_t address;
+    int32_t value;
+} meter_modbus_register_t;
+
+typedef struct meter_modbus_batch {
+    uint16_t address;
+    uint16_t count;
+} meter_modbus_batch_t;
+
+typedef struct meter_modbus {
+    uint8_t slave;
+    int count;
+    int batch_count;
+    meter_modbus_register_t registers[METER_MODBUS_REGISTERS];
+    meter_modbus_batch_t batches[METER_MODBUS_REGISTERS];
+} meter_modbus_t;
+
+uint16_t meter_modbus_crc(const uint8_t *data, int length);
+
+/* NAME:ADDRESS pairs separated by ',', addresses of 32-bit float input registers */
+int meter_modbus_parse(meter_modbus_t *modbus, uint8_t slave, const char *map);
+int meter_modbus_find(const meter_modbus_t *modbus, const char *name);
+
+/* Request of a batch, and the length of its response */
+int meter_modbus_request(const meter_modbus_t *modbus, int batch, uint8_t frame[8]);
+int meter_modbus_response_length(const meter_modbus_t *modbus, int batch);
+
+#define METER_MODBUS_OK         0
+#define METER_MODBUS_CRC        -1
+#define METER_MODBUS_EXCEPTION  -2
+#define METER_MODBUS_FORMAT     -3
+
+int meter_modbus_response(meter_modbus_t *modbus, int batch, const uint8_t *frame, int length);
+
+/* IEEE 754 single of a register pair, in 1/1000 units, without floating point */
+int32_t meter_modbus_milli(uint32_t bits);
+
+#endif
@@ -0,0 +1,71 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_power.h"
+
+/* One pulse is 1/imp_kwh kWh, so n pulses over t us average
+   n * 3.6e15 / (imp_kwh * t) mW.
+
+   The estimate is the average over the last METER_POWER_WINDOW intervals,
+   kept as a running sum so both the update and the read are O(1).
+   Once the time since the last pulse exceeds the average interval, the load
+   cannot be higher than one pulse over that time, so the estimate decays
+   along that bound and reaches zero when the pulses stop. */
+
+#define METER_POWER_MWH_US (3600LL * 1000 * 1000 * 1000 * 1000)
+
+void meter_power_init(meter_power_t *power, uint32_t imp_kwh)
+{
+    memset(power, 0, sizeof(meter_power_t));
+    power->imp_kwh = imp_kwh;
+}
+
+void meter_power_pulse(meter_power_t *power, int64_t time)
+{
+    if (power->pulse_time != 0) {
+        int64_t interval = time - power->pulse_time;
+        if (interval > UINT32_MAX)
+            interval = UINT32_MAX;
+        if (interval < 1)
+            interval = 1;
+
+        if (power->interval_count == METER_POWER_WINDOW)
+            power->interval_sum -= power->intervals[power->interval_index];
+        else
+            power->interval_count++;
+        power->intervals[power->interval_index] = (uint32_t)interval;
+        power->interval_sum += (uint32_t)interval;
+        power->interval_index = (power->interval_index + 1) % METER_POWER_WINDOW;
+    }
+    power->pulse_time = time;
+}
+
+int32_t meter_power_read(const meter_power_t *power, int64_t now)
+{
+    if (power->interval_count == 0 || power->imp_kwh == 0)
+        return 0;
+
+    uint64_t sum = power->interval_sum;
+    uint64_t count = power->interval_count;
+    int64_t elapsed = now - power->pulse_time;
+
+    // Bound by one pulse over the time since the last one
+    if (elapsed > 0 && (uint64_t)elapsed * count > sum) {
+        sum = elapsed;
+        count = 1;
+    }
+
+    uint64_t power_mw = count * METER_POWER_MWH_US / (power->imp_kwh * sum);
+    if (power_mw > INT32_MAX)
+        power_mw = INT32_MAX;
+
+    return (int32_t)power_mw;
+}
@@ -0,0 +1,30 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_POWER_H_
+#define _METER_POWER_H_
+
+#include <stdint.h>
+
+#define METER_POWER_WINDOW 8
+
+typedef struct meter_power {
+    uint32_t imp_kwh;
+    int64_t pulse_time;
+    uint64_t interval_sum;
+    uint32_t intervals[METER_POWER_WINDOW];
+    int interval_count;
+    int interval_index;
+} meter_power_t;
+
+void meter_power_init(meter_power_t *power, uint32_t imp_kwh);
+void meter_power_pulse(meter_power_t *power, int64_t time);
+int32_t meter_power_read(const meter_power_t *power, int64_t now);
+
+#endif
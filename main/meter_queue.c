@@ -0,0 +1,126 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_queue.h"
+
+/* Bounded FIFO of pending uploads. A queued record of a backend and channel
+   absorbs a later one that overlaps or continues its span, since the
+   upload reads the store when it is sent and so carries the newest hours
+   anyway. An outage thus leaves one record per backend and channel that
+   the uploader sends in chunks. When full, the oldest record is dropped to
+   make room. Each change touches at most one record, named by written,
+   and head and count, so a copy in flash can be kept by writing just those. */
+
+void meter_queue_init(meter_queue_t *queue)
+{
+    memset(queue, 0, sizeof(meter_queue_t));
+    queue->written = METER_QUEUE_SIZE;
+}
+
+int meter_queue_push(meter_queue_t *queue, const meter_queue_record_t *record)
+{
+    int result = METER_QUEUE_ADDED;
+
+    for (int i = 0; i < queue->count; ++i) {
+        meter_queue_record_t *queued = &queue->records[(queue->head + i) % METER_QUEUE_SIZE];
+        if (queued->backend != record->backend || queued->channel != record->channel)
+            continue;
+        if (record->key < queued->key || record->key > queued->key + queued->span)
+            continue;
+        int32_t end = record->key + record->span;
+        if (end < queued->key + queued->span)
+            end = queued->key + queued->span;
+        if (end - queued->key > METER_QUEUE_SPAN_MAX)
+            continue;
+        queued->span = end - queued->key;
+        queue->written = (queue->head + i) % METER_QUEUE_SIZE;
+        return METER_QUEUE_MERGED;
+    }
+
+    if (queue->count >= METER_QUEUE_SIZE) {
+        meter_queue_pop(queue);
+        result = METER_QUEUE_DROPPED;
+    }
+    queue->written = (queue->head + queue->count) % METER_QUEUE_SIZE;
+    queue->records[queue->written] = *record;
+    queue->count++;
+
+    return result;
+}
+
+const meter_queue_record_t *meter_queue_peek(const meter_queue_t *queue)
+{
+    if (queue->count == 0)
+        return NULL;
+    return &queue->records[queue->head];
+}
+
+void meter_queue_pop(meter_queue_t *queue)
+{
+    if (queue->count == 0)
+        return;
+    queue->head = (queue->head + 1) % METER_QUEUE_SIZE;
+    queue->count--;
+    queue->written = METER_QUEUE_SIZE;
+}
+
+void meter_queue_consume(meter_queue_t *queue, uint16_t span)
+{
+    meter_queue_record_t *head = &queue->records[queue->head];
+
+    if (queue->count == 0)
+        return;
+    if (span >= head->span) {
+        meter_queue_pop(queue);
+        return;
+    }
+    head->key += span;
+    head->span -= span;
+    queue->written = queue->head;
+}
+
+int meter_queue_valid(const meter_queue_t *queue)
+{
+    return queue->head < METER_QUEUE_SIZE && queue->count <= METER_QUEUE_SIZE;
+}
+
+uint32_t meter_queue_jitter(const uint8_t mac[6], uint32_t window)
+{
+    uint32_t hash = 2166136261u;
+
+    if (window == 0)
+        return 0;
+
+    // FNV-1a, then a finalizer so MACs a few apart land far apart
+    for (int i = 0; i < 6; ++i) {
+        hash ^= mac[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash % window;
+}
+
+uint32_t meter_queue_backoff(uint32_t attempts, uint32_t minimum, uint32_t maximum, uint32_t random)
+{
+    uint32_t delay = minimum;
+
+    while (attempts-- > 1 && delay < maximum)
+        delay *= 2;
+    if (delay > maximum)
+        delay = maximum;
+
+    return delay / 2 + random % (delay / 2 + 1);
+}
@@ -0,0 +1,57 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_QUEUE_H_
+#define _METER_QUEUE_H_
+
+#include <stdint.h>
+
+#ifndef METER_QUEUE_SIZE
+#define METER_QUEUE_SIZE 64
+#endif
+
+#define METER_QUEUE_SPAN_MAX 0xffff
+
+/* One pending upload of a backend, the values are read from the store
+   when it is sent. The record covers span days or minutes from key. */
+typedef struct meter_queue_record {
+    uint32_t created;
+    int32_t key;
+    uint8_t channel;
+    uint8_t backend;
+    uint16_t span;
+} meter_queue_record_t;
+
+typedef struct meter_queue {
+    uint16_t head;
+    uint16_t count;
+    // Slot the last push or consume wrote, METER_QUEUE_SIZE after a pop
+    uint16_t written;
+    meter_queue_record_t records[METER_QUEUE_SIZE];
+} meter_queue_t;
+
+#define METER_QUEUE_ADDED       1
+#define METER_QUEUE_MERGED      0
+#define METER_QUEUE_DROPPED     -1
+
+void meter_queue_init(meter_queue_t *queue);
+int meter_queue_push(meter_queue_t *queue, const meter_queue_record_t *record);
+const meter_queue_record_t *meter_queue_peek(const meter_queue_t *queue);
+void meter_queue_pop(meter_queue_t *queue);
+/* Removes the first span of the head, and the head once it is all sent */
+void meter_queue_consume(meter_queue_t *queue, uint16_t span);
+int meter_queue_valid(const meter_queue_t *queue);
+
+/* Fixed offset of a device in [0, window) from its MAC */
+uint32_t meter_queue_jitter(const uint8_t mac[6], uint32_t window);
+
+/* Exponential backoff of a failed attempt, half fixed and half random */
+uint32_t meter_queue_backoff(uint32_t attempts, uint32_t minimum, uint32_t maximum, uint32_t random);
+
+#endif
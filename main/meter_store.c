@@ -0,0 +1,295 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "meter_store.h"
+#include "meter_time.h"
+
+#define STORE_BLOCK_MAX (1 + 5 + 31 * 5 + 5)
+
+static int32_t store_month(int32_t day)
+{
+    int year, month, mday;
+
+    meter_time_civil(day, &year, &month, &mday);
+    return year * 12 + month - 1;
+}
+
+static int32_t store_mday(int32_t day)
+{
+    int year, month, mday;
+
+    meter_time_civil(day, &year, &month, &mday);
+    return mday;
+}
+
+static int store_month_days(int32_t month)
+{
+    int32_t first = meter_time_days(month / 12, month % 12 + 1, 1);
+    int32_t next = meter_time_days((month + 1) / 12, (month + 1) % 12 + 1, 1);
+
+    return next - first;
+}
+
+static int store_varint(uint8_t *block, uint32_t value)
+{
+    int length = 0;
+
+    while (value >= 0x80) {
+        block[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    block[length++] = (uint8_t)value;
+
+    return length;
+}
+
+static int store_encode(uint8_t *block, int32_t key, const uint32_t *values, int count, uint32_t tag)
+{
+    uint32_t previous = 0;
+    int length = 1;
+
+    length += store_varint(block + length, (uint32_t)key);
+    for (int i = 0; i < count; ++i) {
+        int32_t delta = (int32_t)(values[i] - previous);
+        length += store_varint(block + length, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+        previous = values[i];
+    }
+    length += store_varint(block + length, tag);
+    block[0] = (uint8_t)length;
+
+    return length;
+}
+
+static void store_append(meter_store_arena_t *arena, uint8_t *bytes, uint16_t size, uint16_t *index, int index_count, int32_t key, const uint8_t *block, int length)
+{
+    while (size - arena->used < length) {
+        uint8_t evict = bytes[arena->tail];
+        arena->tail = (arena->tail + evict) % size;
+        arena->used -= evict;
+        arena->count--;
+    }
+
+    index[key % index_count] = arena->head;
+    for (int i = 0; i < length; ++i) {
+        bytes[arena->head] = block[i];
+        arena->head = (arena->head + 1) % size;
+    }
+    arena->used += length;
+    arena->count++;
+}
+
+static uint32_t store_read(const uint8_t *bytes, uint16_t size, uint16_t *pos)
+{
+    uint32_t value = 0;
+
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t c = bytes[*pos];
+        *pos = (*pos + 1) % size;
+        value |= (uint32_t)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0)
+            break;
+    }
+
+    return value;
+}
+
+static int store_find(const meter_store_arena_t *arena, const uint8_t *bytes, uint16_t size, const uint16_t *index, int index_count, int32_t key, uint32_t *values, int count, uint32_t *tag)
+{
+    uint16_t offset = index[key % index_count];
+    uint16_t distance = (offset + size - arena->tail) % size;
+
+    if (arena->count == 0 || distance >= arena->used)
+        return 0;
+
+    uint16_t pos = offset;
+    uint8_t length = bytes[pos];
+    if (length < 2 || distance + length > arena->used)
+        return 0;
+    pos = (pos + 1) % size;
+    if (store_read(bytes, size, &pos) != (uint32_t)key)
+        return 0;
+
+    uint32_t previous = 0;
+    for (int i = 0; i < count; ++i) {
+        uint32_t delta = store_read(bytes, size, &pos);
+        previous += (uint32_t)((int32_t)(delta >> 1) ^ -(int32_t)(delta & 1));
+        values[i] = previous;
+    }
+    *tag = store_read(bytes, size, &pos);
+
+    return 1;
+}
+
+static void store_close_day(meter_store_t *store, int32_t day)
+{
+    uint8_t block[STORE_BLOCK_MAX];
+    int active = 0;
+
+    for (int i = 0; i < 24; ++i)
+        active |= store->hours[i] != 0;
+    if (active) {
+        int length = store_encode(block, day, store->hours, 24, store->tagged);
+        store_append(&store->hour_arena, store->hour_bytes, METER_STORE_HOUR_BYTES, store->hour_index, METER_STORE_HOUR_DAYS, day, block, length);
+        store->closed++;
+    }
+    memset(store->hours, 0, sizeof(store->hours));
+    store->day_cost = 0;
+    store->tagged = 0;
+}
+
+static void store_close_month(meter_store_t *store, int32_t month)
+{
+    uint8_t block[STORE_BLOCK_MAX];
+    int active = 0;
+
+    for (int i = 0; i < 31; ++i)
+        active |= store->days[i] != 0;
+    if (active) {
+        int length = store_encode(block, month, store->days, store_month_days(month), 0);
+        store_append(&store->day_arena, store->day_bytes, METER_STORE_DAY_BYTES, store->day_index, METER_STORE_DAY_MONTHS, month, block, length);
+        store->closed++;
+    }
+    memset(store->days, 0, sizeof(store->days));
+    store->month = 0;
+    store->month_cost = 0;
+}
+
+void meter_store_init(meter_store_t *store)
+{
+    memset(store, 0, sizeof(meter_store_t));
+    store->minute = -1;
+}
+
+void meter_store_advance(meter_store_t *store, int32_t minute)
+{
+    if (store->minute < 0) {
+        store->minute = minute;
+        store->mday = store_mday(minute / 1440);
+        return;
+    }
+    if (minute <= store->minute)
+        return;
+
+    // Minutes skipped since the last pulse had none
+    int32_t elapsed = minute - store->minute;
+    if (elapsed > METER_STORE_MINUTES)
+        elapsed = METER_STORE_MINUTES;
+    for (int32_t i = 1; i <= elapsed; ++i)
+        store->minutes[(store->minute + i) % METER_STORE_MINUTES] = 0;
+
+    int32_t day = store->minute / 1440;
+    int32_t next = minute / 1440;
+    if (day != next) {
+        store_close_day(store, day);
+        if (store_month(day) != store_month(next))
+            store_close_month(store, store_month(day));
+        store->mday = store_mday(next);
+    }
+    store->minute = minute;
+}
+
+int32_t meter_store_add(meter_store_t *store, int32_t minute, uint32_t count, uint32_t price)
+{
+    meter_store_advance(store, minute);
+
+    // A clock stepped backwards counts into the open buckets
+    if (minute < store->minute)
+        minute = store->minute;
+
+    uint16_t *slot = &store->minutes[minute % METER_STORE_MINUTES];
+    *slot = *slot + count > UINT16_MAX ? UINT16_MAX : *slot + count;
+    store->hours[minute / 60 % 24] += count;
+    store->days[store->mday - 1] += count;
+    store->month += count;
+    store->lifetime += count;
+    store->day_cost += (uint64_t)price * count;
+    store->month_cost += (uint64_t)price * count;
+
+    return minute;
+}
+
+void meter_store_tag(meter_store_t *store, int32_t minute)
+{
+    if (store->minute >= 0 && minute / 1440 == store->minute / 1440)
+        store->tagged |= 1u << (minute / 60 % 24);
+}
+
+int meter_store_hours(const meter_store_t *store, int32_t day, uint32_t hours[24])
+{
+    uint32_t tag;
+
+    if (store->minute >= 0 && day == store->minute / 1440) {
+        memcpy(hours, store->hours, sizeof(store->hours));
+        return 1;
+    }
+
+    if (store->minute >= 0 && day < store->minute / 1440 && day >= 0) {
+        if (store_find(&store->hour_arena, store->hour_bytes, METER_STORE_HOUR_BYTES, store->hour_index, METER_STORE_HOUR_DAYS, day, hours, 24, &tag))
+            return 1;
+    }
+
+    memset(hours, 0, sizeof(uint32_t) * 24);
+    return 0;
+}
+
+uint32_t meter_store_day(const meter_store_t *store, int32_t day)
+{
+    if (store->minute < 0 || day < 0 || day > store->minute / 1440)
+        return 0;
+
+    int32_t month = store_month(day);
+    if (month == store_month(store->minute / 1440))
+        return store->days[store_mday(day) - 1];
+
+    uint32_t days[31];
+    uint32_t tag;
+    if (store_find(&store->day_arena, store->day_bytes, METER_STORE_DAY_BYTES, store->day_index, METER_STORE_DAY_MONTHS, month, days, store_month_days(month), &tag))
+        return days[store_mday(day) - 1];
+
+    return 0;
+}
+
+uint32_t meter_store_tagged(const meter_store_t *store, int32_t day)
+{
+    uint32_t hours[24];
+    uint32_t tag;
+
+    if (store->minute < 0 || day < 0 || day > store->minute / 1440)
+        return 0;
+    if (day == store->minute / 1440)
+        return store->tagged;
+    if (store_find(&store->hour_arena, store->hour_bytes, METER_STORE_HOUR_BYTES, store->hour_index, METER_STORE_HOUR_DAYS, day, hours, 24, &tag))
+        return tag;
+
+    return 0;
+}
+
+uint32_t meter_store_minute(const meter_store_t *store, int32_t minute)
+{
+    if (store->minute < 0 || minute > store->minute || store->minute - minute >= METER_STORE_MINUTES)
+        return 0;
+
+    return store->minutes[minute % METER_STORE_MINUTES];
+}
+
+void meter_store_totals(const meter_store_t *store, meter_store_totals_t *totals)
+{
+    totals->hour = 0;
+    totals->day = 0;
+    totals->month = store->month;
+    totals->lifetime = store->lifetime;
+    totals->day_cost = store->day_cost;
+    totals->month_cost = store->month_cost;
+    if (store->minute >= 0) {
+        totals->hour = store->hours[store->minute / 60 % 24];
+        totals->day = store->days[store->mday - 1];
+    }
+}
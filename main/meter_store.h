@@ -0,0 +1,106 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_STORE_H_
+#define _METER_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Multi-resolution pulse store of one channel, keyed by local time:
+
+   - minutes  : raw ring of the last METER_STORE_MINUTES minutes (2 B per minute)
+   - hours    : raw buckets of the open day, then one block per closed day
+   - days     : raw buckets of the open month, then one block per closed month
+
+   A closed block is [length][varint key][zigzag varint deltas of the buckets]
+   [varint tag] appended to a byte ring, evicting the oldest blocks when full. A day is
+   ~30-50 B (2 B per busy hour, 1 B per steady or idle hour) plus 2 B of
+   index, and a day inside a month block ~2 B, so the defaults below keep
+   a month of hours and two years of days in about 3.5 KB per channel, plus
+   0.7 KB for six hours of minutes. Days without pulses take no block at
+   all. The sizes come from the Kconfig, all but the minutes are persisted
+   by the journal twice per channel.
+
+   The tag of a day is the mask of hours that were back-filled from pulses
+   counted before the clock was set. */
+
+#ifndef METER_STORE_HOUR_DAYS
+#define METER_STORE_HOUR_DAYS 31
+#endif
+#ifndef METER_STORE_HOUR_BYTES
+#define METER_STORE_HOUR_BYTES (METER_STORE_HOUR_DAYS * 48)
+#endif
+#ifndef METER_STORE_DAY_MONTHS
+#define METER_STORE_DAY_MONTHS 25
+#endif
+#ifndef METER_STORE_DAY_BYTES
+#define METER_STORE_DAY_BYTES (METER_STORE_DAY_MONTHS * 64)
+#endif
+#ifndef METER_STORE_MINUTES
+#define METER_STORE_MINUTES 360
+#endif
+
+typedef struct meter_store_arena {
+    uint16_t head;
+    uint16_t tail;
+    uint16_t used;
+    uint16_t count;
+} meter_store_arena_t;
+
+typedef struct meter_store {
+    // Open buckets and running totals, each bumped once per pulse
+    int32_t minute;
+    int32_t mday;
+    uint64_t lifetime;
+    uint64_t day_cost;
+    uint64_t month_cost;
+    uint32_t month;
+    uint32_t hours[24];
+    uint32_t days[31];
+    uint32_t tagged;
+    uint32_t closed;
+
+    // Closed blocks
+    meter_store_arena_t hour_arena;
+    meter_store_arena_t day_arena;
+    uint16_t hour_index[METER_STORE_HOUR_DAYS];
+    uint16_t day_index[METER_STORE_DAY_MONTHS];
+    uint8_t hour_bytes[METER_STORE_HOUR_BYTES];
+    uint8_t day_bytes[METER_STORE_DAY_BYTES];
+
+    // Not persisted, everything above is
+    uint16_t minutes[METER_STORE_MINUTES];
+} meter_store_t;
+
+typedef struct meter_store_totals {
+    uint32_t hour;
+    uint32_t day;
+    uint32_t month;
+    uint64_t lifetime;
+    uint64_t day_cost;
+    uint64_t month_cost;
+} meter_store_totals_t;
+
+#define METER_STORE_OPEN_SIZE       (offsetof(meter_store_t, hour_arena))
+#define METER_STORE_PERSISTENT_SIZE (offsetof(meter_store_t, minutes))
+
+void meter_store_init(meter_store_t *store);
+/* The cost is kept as price * pulses, cost = day_cost / imp_kwh */
+int32_t meter_store_add(meter_store_t *store, int32_t minute, uint32_t count, uint32_t price);
+void meter_store_advance(meter_store_t *store, int32_t minute);
+void meter_store_tag(meter_store_t *store, int32_t minute);
+
+int meter_store_hours(const meter_store_t *store, int32_t day, uint32_t hours[24]);
+uint32_t meter_store_day(const meter_store_t *store, int32_t day);
+uint32_t meter_store_tagged(const meter_store_t *store, int32_t day);
+uint32_t meter_store_minute(const meter_store_t *store, int32_t minute);
+void meter_store_totals(const meter_store_t *store, meter_store_totals_t *totals);
+
+#endif
@@ -0,0 +1,115 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "meter_tariff.h"
+#include "meter_time.h"
+
+static const char *tariff_range(const char *text, int *first, int *last, int min, int max)
+{
+    char *end;
+
+    if (*text == '*') {
+        *first = min;
+        *last = max;
+        return text + 1;
+    }
+
+    *first = strtol(text, &end, 10);
+    if (end == text || *end != '-')
+        return NULL;
+    text = end + 1;
+    *last = strtol(text, &end, 10);
+    if (end == text || *first < min || *first > max || *last < min || *last > max)
+        return NULL;
+
+    return end;
+}
+
+int meter_tariff_parse(meter_tariff_t *tariff, const char *text)
+{
+    memset(tariff, 0, sizeof(meter_tariff_t));
+    tariff->day = -1;
+
+    while (*text != 0) {
+        int month_first, month_last, hour_first, hour_last;
+        char *end;
+
+        if (tariff->rules >= METER_TARIFF_RULES)
+            return -1;
+
+        text = tariff_range(text, &month_first, &month_last, 1, 12);
+        if (text == NULL || *text++ != ':')
+            return -1;
+
+        char days = *text++;
+        if ((days != 'a' && days != 'd' && days != 'e') || *text++ != ':')
+            return -1;
+
+        text = tariff_range(text, &hour_first, &hour_last, 0, 24);
+        if (text == NULL || *text++ != ':')
+            return -1;
+
+        long price = strtol(text, &end, 10);
+        if (end == text || price < 0)
+            return -1;
+        text = end;
+        if (*text == ',')
+            text++;
+        else if (*text != 0)
+            return -1;
+
+        int band = ++tariff->rules;
+        tariff->price[band] = price;
+
+        // An empty hour range is the whole day, like '*'
+        if (hour_first == hour_last) {
+            hour_first = 0;
+            hour_last = 24;
+        }
+        for (int month = 1; month <= 12; ++month) {
+            int in_month = month_first <= month_last ? (month >= month_first && month <= month_last)
+                                                     : (month >= month_first || month <= month_last);
+            if (in_month == 0)
+                continue;
+            for (int weekend = 0; weekend < 2; ++weekend) {
+                if ((days == 'd' && weekend) || (days == 'e' && weekend == 0))
+                    continue;
+                for (int hour = 0; hour < 24; ++hour) {
+                    int in_hours = hour_first < hour_last ? (hour >= hour_first && hour < hour_last)
+                                                          : (hour >= hour_first || hour < hour_last);
+                    if (in_hours)
+                        tariff->band[month - 1][weekend][hour] = band;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+uint32_t meter_tariff_price(meter_tariff_t *tariff, int32_t minute)
+{
+    int32_t day = minute / 1440;
+
+    if (day != tariff->day) {
+        int year, month, mday;
+        int weekday = (day + 4) % 7;
+
+        // 1970-01-01 was a Thursday
+        meter_time_civil(day, &year, &month, &mday);
+        tariff->day = day;
+        tariff->month = month - 1;
+        tariff->weekend = weekday == 0 || weekday == 6;
+    }
+
+    return tariff->price[tariff->band[tariff->month][tariff->weekend][minute / 60 % 24]];
+}
@@ -0,0 +1,44 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_TARIFF_H_
+#define _METER_TARIFF_H_
+
+#include <stdint.h>
+
+/* Time-of-use tariff as comma separated rules MONTHS:DAYS:HOURS:PRICE
+
+   - MONTHS : '*' or FIRST-LAST in 1..12, wrapping over the new year
+   - DAYS   : 'a' all days, 'd' weekdays, 'e' Saturday and Sunday
+   - HOURS  : '*' or START-END in 0..24, END excluded, wrapping over midnight
+   - PRICE  : 1/1000 of the currency unit per kWh
+
+   Later rules override earlier ones, so "*:a:*:1630,6-9:d:9-24:4440"
+   is a flat rate with a summer weekday peak. Hours no rule covers are
+   free. The rules are compiled into one band per month, day type and
+   hour, so pricing a pulse is a table lookup. */
+
+#define METER_TARIFF_RULES 15
+#define METER_TARIFF_TEXT  128
+
+typedef struct meter_tariff {
+    uint32_t price[METER_TARIFF_RULES + 1];
+    uint8_t band[12][2][24];
+    int rules;
+
+    // Month and day type of the last priced day
+    int32_t day;
+    uint8_t month;
+    uint8_t weekend;
+} meter_tariff_t;
+
+int meter_tariff_parse(meter_tariff_t *tariff, const char *text);
+uint32_t meter_tariff_price(meter_tariff_t *tariff, int32_t minute);
+
+#endif
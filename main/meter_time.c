@@ -0,0 +1,78 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include "meter_time.h"
+
+/* Proleptic Gregorian conversions on 400-year eras, month 1..12 */
+
+int32_t meter_time_days(int year, int month, int mday)
+{
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    int32_t yoe = year - era * 400;
+    int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+void meter_time_civil(int32_t days, int *year, int *month, int *mday)
+{
+    days += 719468;
+    int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int32_t doe = days - era * 146097;
+    int32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int32_t mp = (5 * doy + 2) / 153;
+
+    *mday = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+uint32_t meter_time_hour(const struct tm *timeinfo)
+{
+    int32_t days = meter_time_days(timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday);
+
+    return (uint32_t)days * 24 + timeinfo->tm_hour;
+}
+
+int32_t meter_time_minute(const struct tm *timeinfo)
+{
+    int32_t days = meter_time_days(timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday);
+
+    return days * 1440 + timeinfo->tm_hour * 60 + timeinfo->tm_min;
+}
+
+int64_t meter_time_epoch(int32_t minute)
+{
+    struct tm timeinfo = { 0 };
+    int year, month, mday;
+
+    meter_time_civil(minute / 1440, &year, &month, &mday);
+    timeinfo.tm_year = year - 1900;
+    timeinfo.tm_mon = month - 1;
+    timeinfo.tm_mday = mday;
+    timeinfo.tm_hour = minute % 1440 / 60;
+    timeinfo.tm_min = minute % 60;
+    timeinfo.tm_isdst = -1;
+
+    return mktime(&timeinfo);
+}
+
+int32_t meter_time_run(int32_t minute, int32_t count)
+{
+    int64_t offset = meter_time_epoch(minute) - (int64_t)minute * 60;
+
+    for (int32_t m = minute - minute % 30 + 30; m < minute + count; m += 30) {
+        if (meter_time_epoch(m) - (int64_t)m * 60 != offset)
+            return m - minute;
+    }
+    return count;
+}
@@ -0,0 +1,34 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _METER_TIME_H_
+#define _METER_TIME_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Days since 1970-01-01 of a local calendar date, independent of TZ */
+int32_t meter_time_days(int year, int month, int mday);
+void meter_time_civil(int32_t days, int *year, int *month, int *mday);
+
+/* Local hour index (days * 24 + hour) of a broken-down local time */
+uint32_t meter_time_hour(const struct tm *timeinfo);
+
+/* Local minute index (days * 1440 + hour * 60 + minute) */
+int32_t meter_time_minute(const struct tm *timeinfo);
+
+/* UTC epoch of a local minute index under the TZ rules, a minute the
+   clock repeats at the offset mktime picks */
+int64_t meter_time_epoch(int32_t minute);
+
+/* Minutes from a local minute, at most count, at its UTC offset, with
+   the changes looked for on the half hour */
+int32_t meter_time_run(int32_t minute, int32_t count);
+
+#endif
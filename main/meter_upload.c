@@ -0,0 +1,121 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "meter_upload.h"
+
+/* Bodies of the batched backends. A batch is the minute buckets of all
+   channels over one upload interval and the latest environment reading,
+   so a request replaces one message per metric and minute, or the hour
+   buckets of a backlog older than the minute ring. Energy is written in
+   Wh with three decimals from the pulses and imp/kWh. */
+
+static int64_t upload_mwh(const meter_upload_channel_t *channel, uint32_t count)
+{
+    return (int64_t)count * 1000000 / channel->imp_kwh;
+}
+
+static uint32_t upload_count(const meter_upload_batch_t *batch, const meter_upload_channel_t *channel, int bucket)
+{
+    return batch->interval == 60 ? channel->counts[bucket] : channel->hours[bucket];
+}
+
+void meter_upload_influx(meter_form_t *form, const meter_upload_batch_t *batch)
+{
+    for (int c = 0; c < batch->channels; ++c) {
+        const meter_upload_channel_t *channel = &batch->channel[c];
+        for (int m = 0; m < batch->buckets; ++m) {
+            uint32_t count = upload_count(batch, channel, m);
+            meter_form_text(form, "energy,device=");
+            meter_form_tag(form, batch->device);
+            meter_form_text(form, ",channel=");
+            meter_form_tag(form, channel->name);
+            meter_form_text(form, " pulses=");
+            meter_form_decimal(form, count, 0);
+            meter_form_text(form, "i,energy=");
+            meter_form_decimal(form, upload_mwh(channel, count), 3);
+            meter_form_text(form, " ");
+            meter_form_decimal(form, batch->time + m * batch->interval, 0);
+            meter_form_text(form, "\n");
+        }
+    }
+
+    if (batch->environment) {
+        const meter_upload_environment_t *env = &batch->env;
+        meter_form_text(form, "environment,device=");
+        meter_form_tag(form, batch->device);
+        meter_form_text(form, " temperature=");
+        meter_form_decimal(form, env->temperature, 2);
+        meter_form_text(form, ",humidity=");
+        meter_form_decimal(form, env->humidity, 2);
+        meter_form_text(form, ",pressure=");
+        meter_form_decimal(form, env->pressure, 2);
+        meter_form_text(form, ",gas=");
+        meter_form_decimal(form, env->gas, 0);
+        meter_form_text(form, "i,iaq=");
+        meter_form_decimal(form, env->iaq, 2);
+        meter_form_text(form, ",co2=");
+        meter_form_decimal(form, env->co2, 2);
+        meter_form_text(form, ",voc=");
+        meter_form_decimal(form, env->voc, 2);
+        meter_form_text(form, " ");
+        meter_form_decimal(form, env->time, 0);
+        meter_form_text(form, "\n");
+    }
+}
+
+void meter_upload_json(meter_form_t *form, const meter_upload_batch_t *batch)
+{
+    meter_form_text(form, "{\"device\":");
+    meter_form_json(form, batch->device);
+    meter_form_text(form, ",\"time\":");
+    meter_form_decimal(form, batch->time, 0);
+    meter_form_text(form, ",\"interval\":");
+    meter_form_decimal(form, batch->interval, 0);
+    meter_form_text(form, ",\"channels\":[");
+    for (int c = 0; c < batch->channels; ++c) {
+        const meter_upload_channel_t *channel = &batch->channel[c];
+        uint32_t total = 0;
+
+        meter_form_text(form, c ? ",{\"name\":" : "{\"name\":");
+        meter_form_json(form, channel->name);
+        meter_form_text(form, ",\"pulses\":[");
+        for (int m = 0; m < batch->buckets; ++m) {
+            uint32_t count = upload_count(batch, channel, m);
+            if (m)
+                meter_form_text(form, ",");
+            meter_form_decimal(form, count, 0);
+            total += count;
+        }
+        meter_form_text(form, "],\"energy\":");
+        meter_form_decimal(form, upload_mwh(channel, total), 3);
+        meter_form_text(form, "}");
+    }
+    meter_form_text(form, "]");
+
+    if (batch->environment) {
+        const meter_upload_environment_t *env = &batch->env;
+        meter_form_text(form, ",\"environment\":{\"time\":");
+        meter_form_decimal(form, env->time, 0);
+        meter_form_text(form, ",\"temperature\":");
+        meter_form_decimal(form, env->temperature, 2);
+        meter_form_text(form, ",\"humidity\":");
+        meter_form_decimal(form, env->humidity, 2);
+        meter_form_text(form, ",\"pressure\":");
+        meter_form_decimal(form, env->pressure, 2);
+        meter_form_text(form, ",\"gas\":");
+        meter_form_decimal(form, env->gas, 0);
+        meter_form_text(form, ",\"iaq\":");
+        meter_form_decimal(form, env->iaq, 2);
+        meter_form_text(form, ",\"co2\":");
+        meter_form_decimal(form, env->co2, 2);
+        meter_form_text(form, ",\"voc\":");
+        meter_form_decimal(form, env->voc, 2);
+        meter_form_text(form, "}");
+    }
+    meter_form_text(form, "}");
+}
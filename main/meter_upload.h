@@ -0,0 +1,62 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#ifndef _METER_UPLOAD_H_
+#define _METER_UPLOAD_H_
+
+#include <stdint.h>
+
+#include "meter_form.h"
+
+#ifndef METER_UPLOAD_CHANNELS
+#define METER_UPLOAD_CHANNELS 4
+#endif
+#ifndef METER_UPLOAD_MINUTES
+#define METER_UPLOAD_MINUTES 240
+#endif
+
+/* Readings in hundredths, gas in ohm */
+typedef struct meter_upload_environment {
+    uint32_t time;
+    int32_t temperature;
+    int32_t humidity;
+    int32_t pressure;
+    int32_t gas;
+    int32_t iaq;
+    int32_t co2;
+    int32_t voc;
+} meter_upload_environment_t;
+
+/* Minute buckets in counts, hour buckets in hours */
+typedef struct meter_upload_channel {
+    const char *name;
+    uint32_t imp_kwh;
+    union {
+        uint16_t counts[METER_UPLOAD_MINUTES];
+        uint32_t hours[METER_UPLOAD_MINUTES / 2];
+    };
+} meter_upload_channel_t;
+
+/* Buckets of interval seconds (60 or 3600) of every channel from time on,
+   and the latest environment */
+typedef struct meter_upload_batch {
+    const char *device;
+    uint32_t time;
+    uint16_t interval;
+    uint16_t buckets;
+    uint8_t channels;
+    uint8_t environment;
+    meter_upload_channel_t channel[METER_UPLOAD_CHANNELS];
+    meter_upload_environment_t env;
+} meter_upload_batch_t;
+
+/* One line per channel and minute plus one for the environment, seconds precision */
+void meter_upload_influx(meter_form_t *form, const meter_upload_batch_t *batch);
+void meter_upload_json(meter_form_t *form, const meter_upload_batch_t *batch);
+
+#endif
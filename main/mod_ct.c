@@ -0,0 +1,184 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <driver/adc.h>
+#include <driver/hw_timer.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "meter_ct.h"
+#include "mod_ct.h"
+#include "mod_watt_hour_meter.h"
+#include "mod_web_server.h"
+
+/* CT clamp on the ADC (TOUT) pin, feeding the "ct" channel of the meter.
+   Every CONFIG_CT_INTERVAL ms a burst of CONFIG_CT_SAMPLES samples is
+   taken at CONFIG_CT_RATE Hz and the power of the burst is held until the
+   next one. The default 200 samples at 1 kHz cover 10 cycles of 50 Hz or
+   12 of 60 Hz. The hardware timer paces the samples: its interrupt
+   notifies the task, which sleeps in between, so the 200 ms of a burst
+   are not spent spinning and lower tasks keep running. The task runs
+   below the pulse and network tasks, a sample delayed past the next tick
+   shifts the rest of the burst. CT_KERNEL_CYCLES is the cost of the RMS
+   kernel per burst.
+
+   The samples alternate between two buffers, /ct shows the last complete
+   burst as text, one count per line, for the host test in tools/host. */
+
+uint32_t CT_BURSTS;
+uint32_t CT_KERNEL_CYCLES;
+uint32_t CT_KERNEL_CYCLES_MAX;
+
+static meter_ct_t ct;
+static meter_ct_burst_t ct_burst;
+static int ct_channel = -1;
+static TaskHandle_t ct_task_handle;
+static uint16_t *ct_samples;
+static uint16_t *ct_last;
+
+static const char * const TAG = "CT";
+
+static inline uint32_t ct_ccount(void)
+{
+    uint32_t ccount;
+
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+}
+
+static void IRAM_ATTR ct_tick(void *parameter)
+{
+    BaseType_t woken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(ct_task_handle, &woken);
+    if (woken == pdTRUE)
+        portYIELD_FROM_ISR();
+}
+
+static void ct_task(void *parameter)
+{
+    int64_t last = esp_timer_get_time();
+    uint32_t pending = 0;
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelayUntil(&wake, CONFIG_CT_INTERVAL / portTICK_PERIOD_MS);
+
+        uint16_t *samples = ct_last == ct_samples ? ct_samples + CONFIG_CT_SAMPLES : ct_samples;
+        ulTaskNotifyTake(pdTRUE, 0);
+        hw_timer_alarm_us(1000 * 1000 / CONFIG_CT_RATE, true);
+        for (int i = 0; i < CONFIG_CT_SAMPLES; ++i) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            adc_read(&samples[i]);
+        }
+        hw_timer_enable(false);
+        ct_last = samples;
+
+        meter_ct_burst_t burst;
+        uint32_t ccount = ct_ccount();
+        meter_ct_burst(&ct, samples, CONFIG_CT_SAMPLES, &burst);
+        ccount = ct_ccount() - ccount;
+        CT_KERNEL_CYCLES = ccount;
+        if (ccount > CT_KERNEL_CYCLES_MAX)
+            CT_KERNEL_CYCLES_MAX = ccount;
+        CT_BURSTS++;
+
+        // The previous burst's power covers the time since it was taken
+        int64_t now = esp_timer_get_time();
+        pending += meter_ct_energy(&ct, ct_burst.power, now - last);
+        last = now;
+        ct_burst = burst;
+
+        // Energy waits for the clock to be set
+        if (mod_watt_hour_meter_energy(ct_channel, pending, burst.power) == 0)
+            pending = 0;
+    }
+}
+
+void mod_ct(void)
+{
+    if (mod_watt_hour_meter_external("ct") < 0)
+        return;
+#if CONFIG_PULSE_STRESS_RATE
+    ESP_LOGE(TAG, "The pulse stress mode has the hardware timer, CT is off");
+    return;
+#endif
+
+    ct_samples = calloc(2 * CONFIG_CT_SAMPLES, sizeof(uint16_t));
+    if (ct_samples == NULL) {
+        ESP_LOGE(TAG, "Error allocating %d samples", 2 * CONFIG_CT_SAMPLES);
+        return;
+    }
+    ct_channel = mod_watt_hour_meter_external("ct");
+
+    adc_config_t adc_config = {
+        .mode = ADC_READ_TOUT_MODE,
+        .clk_div = 8,
+    };
+    adc_init(&adc_config);
+    meter_ct_init(&ct, CONFIG_CT_UA_COUNT, CONFIG_CT_VOLTAGE, CONFIG_CT_POWER_FACTOR, CONFIG_CT_NOISE, CONFIG_CT_CURRENT_MIN);
+
+    xTaskCreate(&ct_task, "ct_task", 2048, NULL, 2, &ct_task_handle);
+    hw_timer_init(ct_tick, NULL);
+    hw_timer_enable(false);
+}
+
+static esp_err_t ct_get_handler(httpd_req_t *req)
+{
+    const uint16_t *samples = ct_last;
+
+    httpd_resp_set_type(req, "text/plain");
+    if (samples) {
+        mod_webserver_printf(req, "# %d Hz, %d uA/count, noise %d/100\n", CONFIG_CT_RATE, CONFIG_CT_UA_COUNT, CONFIG_CT_NOISE);
+        // 16 lines of at most 5 characters per chunk
+        for (int i = 0; i < CONFIG_CT_SAMPLES; i += 16) {
+            char text[16 * 5 + 1];
+            int length = 0;
+            for (int j = i; j < i + 16 && j < CONFIG_CT_SAMPLES; ++j)
+                length += sprintf(text + length, "%u\n", samples[j] & 0x3FF);
+            httpd_resp_send_chunk(req, text, length);
+        }
+    }
+    mod_webserver_printf(req, "", 0);
+
+    return ESP_OK;
+}
+
+static httpd_uri_t ct_uri = {
+    .uri        = "/ct",
+    .method     = HTTP_GET,
+    .handler    = ct_get_handler,
+};
+
+void mod_ct_start(httpd_handle_t server)
+{
+    httpd_register_uri_handler(server, &ct_uri);
+}
+
+void mod_ct_http_handler(httpd_req_t *req)
+{
+    if (ct_channel < 0)
+        return;
+
+    meter_ct_burst_t burst = ct_burst;
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "CT : %u mA, %u V, %d W<br>", burst.current, burst.voltage, burst.power / 1000);
+    mod_webserver_printf(req, "CT Offset : %u.%02u, RMS %u.%02u counts, %u.%02u without noise<br>", burst.offset >> 8, (burst.offset & 0xFF) * 100 / 256,
+                              burst.rms >> 8, (burst.rms & 0xFF) * 100 / 256, burst.signal >> 8, (burst.signal & 0xFF) * 100 / 256);
+    mod_webserver_printf(req, "CT Kernel : %u cycles (%u max) per %d samples, %u bursts<br>", CT_KERNEL_CYCLES, CT_KERNEL_CYCLES_MAX,
+                              CONFIG_CT_SAMPLES, CT_BURSTS);
+    mod_webserver_printf(req, "</p>");
+}
@@ -0,0 +1,26 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _MOD_CT_H_
+#define _MOD_CT_H_
+
+#include <stdint.h>
+
+#include <esp_http_server.h>
+
+extern uint32_t CT_BURSTS;
+extern uint32_t CT_KERNEL_CYCLES;
+extern uint32_t CT_KERNEL_CYCLES_MAX;
+
+void mod_ct(void);
+void mod_ct_start(httpd_handle_t server);
+
+void mod_ct_http_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,308 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/x509_crt.h>
+
+#include "mod_https.h"
+#include "mod_web_server.h"
+
+/* Minimal HTTPS transport for the uploader. esp_http_client offers no way
+   to keep a TLS session, so a full handshake, seconds of CPU and tens of
+   KB of heap on the ESP8266, was paid for every hourly upload. Here the
+   session (ID or ticket) of each server is kept after a handshake and
+   offered on the next connection, so later handshakes are abbreviated
+   and skip the certificate and key exchange.
+
+   The ssl context is shared, uploads are sequential. Servers are always
+   verified, with one of two trust anchors:
+
+   - UPLOAD_TLS_CA      : the CA certificates in main/upload_ca.pem, built
+                          into the app, and the usual chain verification
+   - UPLOAD_TLS_FINGERPRINT : the SHA-256 of the server's own certificate,
+                          which then stands in for the chain; renewing
+                          the certificate needs a new fingerprint
+
+   Either way the name, validity and key of the certificate are checked by
+   mbedtls and any flag left fails the connection: during the handshake
+   with a CA, after it with a pin, as mbedtls requires a CA chain to fail
+   the handshake itself. Without an anchor
+   mod_https_init refuses https:// URLs.
+
+   HTTPS_HANDSHAKE_MS and HTTPS_HEAP_PEAK are of the last connection, the
+   heap sampled between handshake steps and around the request. */
+
+uint32_t HTTPS_HANDSHAKES;
+uint32_t HTTPS_RESUMED;
+uint32_t HTTPS_HANDSHAKE_MS;
+uint32_t HTTPS_HEAP_PEAK;
+
+static mbedtls_entropy_context https_entropy;
+static mbedtls_ctr_drbg_context https_ctr_drbg;
+static mbedtls_ssl_config https_conf;
+static mbedtls_ssl_context https_ssl;
+static mbedtls_net_context https_net;
+#ifdef CONFIG_UPLOAD_TLS_CA
+static mbedtls_x509_crt https_ca;
+#endif
+static int https_ready;
+static int https_certificates;
+static uint32_t https_heap;
+static uint32_t https_heap_min;
+
+static const char * const TAG = "HTTPS";
+
+static void https_sample(void)
+{
+    uint32_t heap = esp_get_free_heap_size();
+
+    if (heap < https_heap_min)
+        https_heap_min = heap;
+}
+
+static int https_pinning(void)
+{
+#ifdef CONFIG_UPLOAD_TLS_CA
+    return 0;
+#else
+    return sizeof(CONFIG_UPLOAD_TLS_FINGERPRINT) == 65;
+#endif
+}
+
+// Called from the top of the chain down to the server's certificate at depth 0
+static int https_verify(void *parameter, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    https_certificates++;
+    https_sample();
+#ifndef CONFIG_UPLOAD_TLS_CA
+    static const char fingerprint[] = CONFIG_UPLOAD_TLS_FINGERPRINT;
+    unsigned char hash[32];
+    char hex[65];
+
+    if (!https_pinning())
+        return 0;
+
+    // The pin on the leaf replaces the chain, its other flags stay
+    *flags &= ~MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+    if (depth != 0)
+        return 0;
+
+    mbedtls_sha256_ret(crt->raw.p, crt->raw.len, hash, 0);
+    for (int i = 0; i < 32; ++i) {
+        sprintf(hex + i * 2, "%02x", hash[i]);
+    }
+    if (strcasecmp(hex, fingerprint) != 0)
+        *flags |= MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+#endif
+
+    return 0;
+}
+
+static esp_err_t https_setup(void)
+{
+    if (https_ready)
+        return ESP_OK;
+
+    mbedtls_entropy_init(&https_entropy);
+    mbedtls_ctr_drbg_init(&https_ctr_drbg);
+    if (mbedtls_ctr_drbg_seed(&https_ctr_drbg, mbedtls_entropy_func, &https_entropy, NULL, 0) != 0)
+        return ESP_FAIL;
+
+    mbedtls_ssl_config_init(&https_conf);
+    if (mbedtls_ssl_config_defaults(&https_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        return ESP_FAIL;
+#ifdef CONFIG_UPLOAD_TLS_CA
+    extern const unsigned char upload_ca_pem_start[] asm("_binary_upload_ca_pem_start");
+    extern const unsigned char upload_ca_pem_end[] asm("_binary_upload_ca_pem_end");
+    mbedtls_x509_crt_init(&https_ca);
+    if (mbedtls_x509_crt_parse(&https_ca, upload_ca_pem_start, upload_ca_pem_end - upload_ca_pem_start) != 0) {
+        ESP_LOGE(TAG, "Error parsing upload_ca.pem");
+        return ESP_FAIL;
+    }
+    mbedtls_ssl_conf_ca_chain(&https_conf, &https_ca, NULL);
+#endif
+    // mbedtls refuses VERIFY_REQUIRED without a CA chain, a pin is checked after the handshake
+    mbedtls_ssl_conf_authmode(&https_conf, https_pinning() ? MBEDTLS_SSL_VERIFY_OPTIONAL : MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_verify(&https_conf, https_verify, NULL);
+    mbedtls_ssl_conf_rng(&https_conf, mbedtls_ctr_drbg_random, &https_ctr_drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&https_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    https_ready = 1;
+    return ESP_OK;
+}
+
+esp_err_t mod_https_init(mod_https_t *https, const char *url)
+{
+    static const char scheme[] = "https://";
+
+    memset(https, 0, sizeof(mod_https_t));
+    mbedtls_ssl_session_init(&https->session);
+    if (strncmp(url, scheme, sizeof(scheme) - 1) != 0)
+        return ESP_ERR_INVALID_ARG;
+#ifndef CONFIG_UPLOAD_TLS_CA
+    if (!https_pinning()) {
+        ESP_LOGE(TAG, "No UPLOAD_TLS_CA or 64-digit UPLOAD_TLS_FINGERPRINT, %s refused", url);
+        return ESP_ERR_INVALID_STATE;
+    }
+#endif
+
+    // host[:port]/path
+    const char *host = url + sizeof(scheme) - 1;
+    const char *path = strchr(host, '/');
+    const char *end = path ? path : host + strlen(host);
+    const char *colon = memchr(host, ':', end - host);
+    const char *host_end = colon ? colon : end;
+    if (host_end - host >= sizeof(https->host) || (colon && end - colon - 1 >= sizeof(https->port)))
+        return ESP_ERR_INVALID_ARG;
+
+    memcpy(https->host, host, host_end - host);
+    if (colon)
+        memcpy(https->port, colon + 1, end - colon - 1);
+    else
+        strcpy(https->port, "443");
+    https->path = path ? path : "/";
+
+    return ESP_OK;
+}
+
+esp_err_t mod_https_open(mod_https_t *https)
+{
+    int64_t start = esp_timer_get_time();
+    int ret;
+
+    if (https_setup() != ESP_OK)
+        return ESP_FAIL;
+
+    https_heap = https_heap_min = esp_get_free_heap_size();
+    https_certificates = 0;
+
+    mbedtls_net_init(&https_net);
+    mbedtls_ssl_init(&https_ssl);
+    if (mbedtls_net_connect(&https_net, https->host, https->port, MBEDTLS_NET_PROTO_TCP) != 0) {
+        ESP_LOGE(TAG, "Connect %s:%s failed", https->host, https->port);
+        mod_https_close(https);
+        return ESP_FAIL;
+    }
+    if (mbedtls_ssl_setup(&https_ssl, &https_conf) != 0 || mbedtls_ssl_set_hostname(&https_ssl, https->host) != 0) {
+        mod_https_close(https);
+        return ESP_ERR_NO_MEM;
+    }
+    mbedtls_ssl_set_bio(&https_ssl, &https_net, mbedtls_net_send, mbedtls_net_recv, NULL);
+    if (https->saved)
+        mbedtls_ssl_set_session(&https_ssl, &https->session);
+
+    // Step by step to see the heap in between
+    while (https_ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        ret = mbedtls_ssl_handshake_step(&https_ssl);
+        https_sample();
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+            continue;
+        if (ret != 0) {
+            ESP_LOGE(TAG, "Handshake %s failed -0x%x, verify 0x%x", https->host, -ret, mbedtls_ssl_get_verify_result(&https_ssl));
+            https->saved = 0;
+            mod_https_close(https);
+            return ESP_FAIL;
+        }
+    }
+    if (mbedtls_ssl_get_verify_result(&https_ssl) != 0) {
+        ESP_LOGE(TAG, "Certificate of %s refused, verify 0x%x", https->host, mbedtls_ssl_get_verify_result(&https_ssl));
+        https->saved = 0;
+        mod_https_close(https);
+        return ESP_FAIL;
+    }
+
+    // A resumed handshake carries no certificate, it was verified when new
+    HTTPS_HANDSHAKES++;
+    if (https_certificates == 0)
+        HTTPS_RESUMED++;
+    HTTPS_HANDSHAKE_MS = (esp_timer_get_time() - start) / 1000;
+    ESP_LOGI(TAG, "%s handshake %u ms%s", https->host, HTTPS_HANDSHAKE_MS, https_certificates ? "" : ", resumed");
+
+    // Keep the session, a new ticket or ID replaces the old one
+    mbedtls_ssl_session_free(&https->session);
+    mbedtls_ssl_session_init(&https->session);
+    https->saved = mbedtls_ssl_get_session(&https_ssl, &https->session) == 0;
+
+    return ESP_OK;
+}
+
+int mod_https_write(void *context, const char *data, int length)
+{
+    int written = 0;
+
+    while (written < length) {
+        int ret = mbedtls_ssl_write(&https_ssl, (const unsigned char*)data + written, length - written);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+            continue;
+        if (ret <= 0)
+            return ret;
+        written += ret;
+    }
+    https_sample();
+
+    return written;
+}
+
+int mod_https_status(mod_https_t *https)
+{
+    char buffer[32];
+    int length = 0;
+
+    // "HTTP/1.1 200 OK", the body is not needed and goes with the close
+    while (length < 12) {
+        int ret = mbedtls_ssl_read(&https_ssl, (unsigned char*)buffer + length, sizeof(buffer) - 1 - length);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+            continue;
+        if (ret <= 0)
+            return -1;
+        length += ret;
+    }
+    https_sample();
+
+    buffer[length] = 0;
+    if (strncmp(buffer, "HTTP/1.", 7) != 0)
+        return -1;
+    return atoi(buffer + 9);
+}
+
+void mod_https_close(mod_https_t *https)
+{
+    if (https_ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER)
+        mbedtls_ssl_close_notify(&https_ssl);
+    mbedtls_ssl_free(&https_ssl);
+    mbedtls_net_free(&https_net);
+
+    if (https_heap > https_heap_min)
+        HTTPS_HEAP_PEAK = https_heap - https_heap_min;
+}
+
+void mod_https_http_handler(httpd_req_t *req)
+{
+    if (HTTPS_HANDSHAKES == 0)
+        return;
+
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "HTTPS : %u handshakes, %u resumed<br>", HTTPS_HANDSHAKES, HTTPS_RESUMED);
+    mod_webserver_printf(req, "HTTPS Last : handshake %u ms, heap peak %u B<br>", HTTPS_HANDSHAKE_MS, HTTPS_HEAP_PEAK);
+    mod_webserver_printf(req, "</p>");
+}
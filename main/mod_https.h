@@ -0,0 +1,46 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#ifndef _MOD_HTTPS_H_
+#define _MOD_HTTPS_H_
+
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include <mbedtls/ssl.h>
+
+extern uint32_t HTTPS_HANDSHAKES;
+extern uint32_t HTTPS_RESUMED;
+extern uint32_t HTTPS_HANDSHAKE_MS;
+extern uint32_t HTTPS_HEAP_PEAK;
+
+/* One server, and the TLS session kept for it between connections */
+typedef struct mod_https {
+    char host[64];
+    char port[6];
+    const char *path;
+    mbedtls_ssl_session session;
+    int saved;
+} mod_https_t;
+
+/* Returns ESP_ERR_INVALID_ARG unless the URL is https://,
+   ESP_ERR_INVALID_STATE when no trust anchor is configured */
+esp_err_t mod_https_init(mod_https_t *https, const char *url);
+
+/* One request per connection, the peer closes it after the response */
+esp_err_t mod_https_open(mod_https_t *https);
+int mod_https_write(void *https, const char *data, int length);
+/* Returns the HTTP status of the response or -1 */
+int mod_https_status(mod_https_t *https);
+void mod_https_close(mod_https_t *https);
+
+void mod_https_http_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,557 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include "meter_queue.h"
+#include "meter_store.h"
+#include "mod_journal.h"
+#include "mod_tariff.h"
+#include "mod_watt_hour_meter.h"
+#include "mod_web_server.h"
+
+/* Append-only journal of PULSE_STORE in the "journal" NVS partition.
+
+   Bucket increments are merged in RAM and written every JOURNAL_INTERVAL
+   seconds as one segment blob "j<seq>" of 8-byte hourly records. A channel
+   fed from a meter's own counter (Modbus) also gets a reading record, the
+   counter value booked last, in the same segment as the counts booked up
+   to it, and the snapshot header carries it too; after a reboot the
+   difference to the first new reading is what the journal missed. After
+   JOURNAL_SEGMENTS segments the persistent part of each store is compacted
+   into one of two snapshot slots, A and B, that alternate: 1 KB chunk
+   blobs "a<channel>.<n>" under a header blob "a<channel>" (or "b..."),
+   which carries a generation number, names the first segment it does not
+   contain and holds a checksum per chunk. The inactive slot is written
+   completely before its header, the commit record, is replaced, so a power
+   cut leaves the other slot intact. Boot takes the valid slot with the
+   newest generation and falls back to the other one; the segments since
+   the older snapshot are kept for that, so 2 * JOURNAL_SEGMENTS are
+   replayed at most, 3 * JOURNAL_SEGMENTS while compactions fail. Beyond
+   that no segments are written, counts are dropped and the page says so.
+   Only chunks whose checksum differs from the slot's last contents are
+   rewritten: the open buckets every time, the closed blocks only after a
+   day or month closed.
+
+   The partition also holds the upload queue of mod_upload, opened through
+   mod_journal_open, and is budgeted for both.
+
+   Space: the "journal" partition of partitions.csv has 64 KB, 15 pages
+   of 126 entries usable next to the page NVS keeps free. A snapshot slot
+   with the default METER_STORE_* sizes is 3.5 KB, ~120 entries, so four
+   channels take ~960 entries, 48 segments at most ~480 more and the 64
+   queued uploads, three entries each, ~200. The build fails when slots
+   and queue exceed JOURNAL_BUDGET.
+
+   Wear: a steady channel adds one or two records per flush, about four
+   32-byte NVS entries with the blob header. At the default 900 s interval
+   that is ~400 entries a day, six compactions add ~200 entries and a day
+   close ~100 more, so one channel writes ~6 of the 126-entry NVS pages a
+   day, four channels ~22. A queued upload costs four entries when queued
+   and one when sent, so Forms for four channels and InfluxDB and JSON
+   every 15 minutes add ~1,400 entries, ~11 pages a day. NVS rotates those
+   over the 16 pages of the partition, so each 4 KB sector is erased about
+   twice a day: about 7,500 cycles in 10 years, against the 100,000 rated
+   cycles. The journal's bytes are accumulated in "wear" and shown on the
+   web page, so the real rate can be checked in the field. */
+
+#define JOURNAL_PENDING 32
+#define JOURNAL_CHUNK   1024
+#define JOURNAL_CHUNKS  ((METER_STORE_PERSISTENT_SIZE + JOURNAL_CHUNK - 1) / JOURNAL_CHUNK)
+#define JOURNAL_REPLAY  (CONFIG_JOURNAL_SEGMENTS * 3)
+#define JOURNAL_BUDGET  (40 * 1024)
+/* A queued upload is a blob: index, chunk header and one data entry */
+#define JOURNAL_QUEUE_SIZE (METER_QUEUE_SIZE * 3 * 32)
+/* journal_record_t.tagged of a reading record, its hour holds the reading */
+#define JOURNAL_READING 2
+
+_Static_assert(2 * WATT_HOUR_METER_CHANNELS * METER_STORE_PERSISTENT_SIZE + JOURNAL_QUEUE_SIZE <= JOURNAL_BUDGET,
+               "METER_STORE_* sizes and METER_QUEUE_SIZE do not fit the journal partition");
+
+typedef struct journal_record {
+    uint32_t hour;
+    uint8_t channel;
+    uint8_t tagged;
+    uint16_t count;
+} journal_record_t;
+
+typedef struct journal_snapshot {
+    uint32_t generation;
+    uint32_t head;
+    uint32_t size;
+    uint32_t reading;
+    uint32_t reading_valid;
+    uint32_t checksum[JOURNAL_CHUNKS];
+} journal_snapshot_t;
+
+static journal_record_t journal_pending[JOURNAL_PENDING];
+static int journal_pending_count;
+
+// Per channel: the slot the newest snapshot is in (-1 none) and what each slot holds
+static int journal_slot[WATT_HOUR_METER_CHANNELS];
+static uint32_t journal_generation[WATT_HOUR_METER_CHANNELS];
+static uint32_t journal_checksum[WATT_HOUR_METER_CHANNELS][2][JOURNAL_CHUNKS];
+
+// Last reading booked per channel, as the pending records and the store have it
+static uint32_t journal_reading[WATT_HOUR_METER_CHANNELS];
+static uint32_t journal_reading_valid;
+
+// Copy of the store being written, so the meter lock is not held across flash writes
+static uint8_t journal_scratch[METER_STORE_PERSISTENT_SIZE];
+
+static SemaphoreHandle_t journal_mutex;
+static nvs_handle journal_handle;
+static uint32_t journal_tail;
+static uint32_t journal_head;
+static uint32_t journal_seq;
+static int journal_compact_request;
+static int journal_compact_failed;
+static int journal_restored;
+
+static uint64_t journal_bytes;
+static uint32_t journal_segments;
+static uint32_t journal_compactions;
+static uint32_t journal_dropped;
+static uint32_t journal_replay_segments;
+static uint32_t journal_replay_ms;
+
+static const char * const TAG = "JOURNAL";
+
+static uint32_t journal_hash(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 16777619u;
+
+    return hash;
+}
+
+void mod_journal_add(int channel, uint32_t hour, uint32_t count, int tagged)
+{
+    for (int i = 0; i < journal_pending_count; ++i) {
+        journal_record_t *record = &journal_pending[i];
+        if (record->hour == hour && record->channel == channel && record->tagged == tagged && record->count + count <= UINT16_MAX) {
+            record->count += count;
+            return;
+        }
+    }
+
+    while (count) {
+        if (journal_pending_count >= JOURNAL_PENDING) {
+            journal_dropped++;
+            return;
+        }
+
+        journal_record_t *record = &journal_pending[journal_pending_count++];
+        record->hour = hour;
+        record->channel = channel;
+        record->tagged = tagged;
+        record->count = count > UINT16_MAX ? UINT16_MAX : count;
+        count -= record->count;
+    }
+}
+
+void mod_journal_reading(int channel, uint32_t reading)
+{
+    journal_reading[channel] = reading;
+    journal_reading_valid |= 1 << channel;
+
+    for (int i = 0; i < journal_pending_count; ++i) {
+        journal_record_t *record = &journal_pending[i];
+        if (record->channel == channel && record->tagged == JOURNAL_READING) {
+            record->hour = reading;
+            return;
+        }
+    }
+    if (journal_pending_count >= JOURNAL_PENDING) {
+        journal_dropped++;
+        return;
+    }
+
+    journal_record_t *record = &journal_pending[journal_pending_count++];
+    record->hour = reading;
+    record->channel = channel;
+    record->tagged = JOURNAL_READING;
+    record->count = 0;
+}
+
+int mod_journal_booked(int channel, uint32_t *reading)
+{
+    int valid;
+
+    portENTER_CRITICAL();
+    valid = (journal_reading_valid >> channel) & 1;
+    *reading = journal_reading[channel];
+    portEXIT_CRITICAL();
+
+    return valid;
+}
+
+static void journal_apply(const journal_record_t *record)
+{
+    if (record->channel >= mod_watt_hour_meter_channels())
+        return;
+    if (record->tagged == JOURNAL_READING) {
+        journal_reading[record->channel] = record->hour;
+        journal_reading_valid |= 1 << record->channel;
+        return;
+    }
+    int32_t minute = (int32_t)record->hour * 60;
+    minute = meter_store_add(PULSE_STORE[record->channel], minute, record->count, mod_tariff_price(minute));
+    if (record->tagged)
+        meter_store_tag(PULSE_STORE[record->channel], minute);
+}
+
+static void journal_write_segment(void)
+{
+    journal_record_t records[JOURNAL_PENDING];
+    int count;
+
+    portENTER_CRITICAL();
+    count = journal_pending_count;
+    memcpy(records, journal_pending, count * sizeof(journal_record_t));
+    journal_pending_count = 0;
+    portEXIT_CRITICAL();
+
+    if (count == 0)
+        return;
+
+    // Replay would not reach this segment
+    if (journal_seq - journal_tail >= JOURNAL_REPLAY) {
+        ESP_LOGE(TAG, "Journal full, compaction failed %d times, %d records dropped", journal_compact_failed, count);
+        journal_dropped += count;
+        return;
+    }
+
+    char key[16];
+    sprintf(key, "j%u", journal_seq);
+    mod_watt_hour_meter_flash_begin();
+    esp_err_t err = nvs_set_blob(journal_handle, key, records, count * sizeof(journal_record_t));
+    if (err == ESP_OK)
+        nvs_commit(journal_handle);
+    mod_watt_hour_meter_flash_end();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing segment %s (%d)", key, err);
+        journal_dropped += count;
+        return;
+    }
+
+    journal_seq++;
+    journal_segments++;
+    journal_bytes += count * sizeof(journal_record_t);
+}
+
+static void journal_drop(int channel)
+{
+    int count = 0;
+
+    for (int i = 0; i < journal_pending_count; ++i) {
+        if (journal_pending[i].channel == channel)
+            continue;
+        journal_pending[count++] = journal_pending[i];
+    }
+
+    journal_pending_count = count;
+}
+
+static esp_err_t journal_write_store(int channel, uint32_t head)
+{
+    const uint8_t *store = journal_scratch;
+    int slot = journal_slot[channel] == 0 ? 1 : 0;
+    uint32_t *written = journal_checksum[channel][slot];
+    journal_snapshot_t snapshot;
+    esp_err_t err = ESP_OK;
+    char key[16];
+
+    // The copy and the dropped records match, later pulses go to the next segment
+    mod_watt_hour_meter_lock();
+    portENTER_CRITICAL();
+    journal_drop(channel);
+    snapshot.reading = journal_reading[channel];
+    snapshot.reading_valid = (journal_reading_valid >> channel) & 1;
+    portEXIT_CRITICAL();
+    memcpy(journal_scratch, PULSE_STORE[channel], METER_STORE_PERSISTENT_SIZE);
+    mod_watt_hour_meter_unlock();
+
+    snapshot.generation = journal_generation[channel] + 1;
+    snapshot.head = head;
+    snapshot.size = METER_STORE_PERSISTENT_SIZE;
+
+    // The inactive slot first, the newest snapshot stays valid until its header is replaced
+    mod_watt_hour_meter_flash_begin();
+    for (int i = 0; i < JOURNAL_CHUNKS && err == ESP_OK; ++i) {
+        size_t offset = i * JOURNAL_CHUNK;
+        size_t size = METER_STORE_PERSISTENT_SIZE - offset < JOURNAL_CHUNK ? METER_STORE_PERSISTENT_SIZE - offset : JOURNAL_CHUNK;
+        snapshot.checksum[i] = journal_hash(store + offset, size);
+        if (snapshot.checksum[i] == written[i])
+            continue;
+
+        sprintf(key, "%c%d.%d", 'a' + slot, channel, i);
+        written[i] = 0;
+        err = nvs_set_blob(journal_handle, key, store + offset, size);
+        if (err == ESP_OK) {
+            written[i] = snapshot.checksum[i];
+            journal_bytes += size;
+        }
+    }
+
+    // The header is the commit record of the slot
+    if (err == ESP_OK) {
+        sprintf(key, "%c%d", 'a' + slot, channel);
+        err = nvs_set_blob(journal_handle, key, &snapshot, sizeof(journal_snapshot_t));
+        journal_bytes += sizeof(journal_snapshot_t);
+    }
+    if (err == ESP_OK)
+        err = nvs_commit(journal_handle);
+    mod_watt_hour_meter_flash_end();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing snapshot %s (%d)", key, err);
+        return err;
+    }
+
+    journal_slot[channel] = slot;
+    journal_generation[channel] = snapshot.generation;
+
+    return ESP_OK;
+}
+
+static void journal_write_snapshot(void)
+{
+    // Everything before the new head is flushed, and later pulses land at or after it
+    journal_write_segment();
+    uint32_t head = journal_seq;
+    esp_err_t err = ESP_OK;
+
+    for (int channel = 0; channel < mod_watt_hour_meter_channels(); ++channel) {
+        if (journal_write_store(channel, head) != ESP_OK)
+            err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        journal_compact_failed++;
+        ESP_LOGE(TAG, "Compaction failed, %d segments left before the journal stops", JOURNAL_REPLAY - (int)(journal_seq - journal_tail));
+        return;
+    }
+
+    // The older slots start at the previous head, their segments stay for the fallback
+    mod_watt_hour_meter_flash_begin();
+    nvs_set_u32(journal_handle, "head", journal_head);
+    for (uint32_t seq = journal_tail; seq != journal_head; ++seq) {
+        char key[16];
+        sprintf(key, "j%u", seq);
+        nvs_erase_key(journal_handle, key);
+    }
+    nvs_set_u64(journal_handle, "wear", journal_bytes);
+    nvs_commit(journal_handle);
+    mod_watt_hour_meter_flash_end();
+
+    journal_tail = journal_head;
+    journal_head = head;
+    journal_compactions++;
+    journal_compact_failed = 0;
+    journal_compact_request = 0;
+}
+
+static int journal_read_slot(int channel, int slot, const journal_snapshot_t *snapshot)
+{
+    uint8_t *store = (uint8_t *)PULSE_STORE[channel];
+    char key[16];
+
+    if (snapshot->size != METER_STORE_PERSISTENT_SIZE)
+        return 0;
+
+    for (int i = 0; i < JOURNAL_CHUNKS; ++i) {
+        size_t offset = i * JOURNAL_CHUNK;
+        size_t size = METER_STORE_PERSISTENT_SIZE - offset < JOURNAL_CHUNK ? METER_STORE_PERSISTENT_SIZE - offset : JOURNAL_CHUNK;
+        sprintf(key, "%c%d.%d", 'a' + slot, channel, i);
+        if (nvs_get_blob(journal_handle, key, store + offset, &size) != ESP_OK || journal_hash(store + offset, size) != snapshot->checksum[i]) {
+            ESP_LOGE(TAG, "Snapshot %s is damaged", key);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int journal_read_store(int channel, uint32_t *head)
+{
+    journal_snapshot_t snapshot[2];
+    int valid[2];
+
+    for (int slot = 0; slot < 2; ++slot) {
+        char key[16];
+        size_t size = sizeof(journal_snapshot_t);
+        sprintf(key, "%c%d", 'a' + slot, channel);
+        valid[slot] = nvs_get_blob(journal_handle, key, &snapshot[slot], &size) == ESP_OK && size == sizeof(journal_snapshot_t);
+    }
+
+    // Newest generation first, then the other slot
+    int first = valid[1] && (!valid[0] || (int32_t)(snapshot[1].generation - snapshot[0].generation) > 0) ? 1 : 0;
+    for (int i = 0; i < 2; ++i) {
+        int slot = first ^ i;
+        if (!valid[slot] || !journal_read_slot(channel, slot, &snapshot[slot]))
+            continue;
+
+        if (i)
+            ESP_LOGW(TAG, "Channel %d restored from the older snapshot", channel);
+        memcpy(journal_checksum[channel][slot], snapshot[slot].checksum, sizeof(snapshot[slot].checksum));
+        journal_slot[channel] = slot;
+        journal_generation[channel] = snapshot[slot].generation;
+        journal_reading[channel] = snapshot[slot].reading;
+        if (snapshot[slot].reading_valid)
+            journal_reading_valid |= 1 << channel;
+        *head = snapshot[slot].head;
+        return 1;
+    }
+
+    // Only reached without any valid slot
+    meter_store_init(PULSE_STORE[channel]);
+    return 0;
+}
+
+static void journal_replay(void)
+{
+    int64_t start = esp_timer_get_time();
+    uint32_t snapshot_head[WATT_HOUR_METER_CHANNELS] = { 0 };
+
+    nvs_get_u32(journal_handle, "head", &journal_tail);
+    nvs_get_u64(journal_handle, "wear", &journal_bytes);
+    journal_head = journal_tail;
+
+    // Snapshots
+    for (int channel = 0; channel < mod_watt_hour_meter_channels(); ++channel) {
+        journal_slot[channel] = -1;
+        if (journal_read_store(channel, &snapshot_head[channel])) {
+            journal_restored = 1;
+            if ((int32_t)(snapshot_head[channel] - journal_head) > 0)
+                journal_head = snapshot_head[channel];
+        }
+        else {
+            snapshot_head[channel] = journal_tail;
+        }
+    }
+
+    // Segments
+    uint32_t seq;
+    for (seq = journal_tail; seq != journal_tail + JOURNAL_REPLAY; ++seq) {
+        journal_record_t records[JOURNAL_PENDING];
+        size_t size = sizeof(records);
+        char key[16];
+        sprintf(key, "j%u", seq);
+        if (nvs_get_blob(journal_handle, key, records, &size) != ESP_OK)
+            break;
+        for (int i = 0; i < size / sizeof(journal_record_t); ++i) {
+            if (records[i].channel < WATT_HOUR_METER_CHANNELS && (int32_t)(seq - snapshot_head[records[i].channel]) < 0)
+                continue;
+            journal_apply(&records[i]);
+        }
+        journal_replay_segments++;
+        journal_restored = 1;
+    }
+    journal_seq = seq;
+
+    // Replayed hours land on their first minute, which the minute ring should not show
+    for (int channel = 0; channel < mod_watt_hour_meter_channels(); ++channel)
+        memset(PULSE_STORE[channel]->minutes, 0, sizeof(PULSE_STORE[channel]->minutes));
+
+    journal_replay_ms = (esp_timer_get_time() - start) / 1000;
+    ESP_LOGI(TAG, "Replayed %u segments in %u ms", journal_replay_segments, journal_replay_ms);
+}
+
+void mod_journal_flush(void)
+{
+    if (journal_mutex == NULL)
+        return;
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    journal_write_segment();
+    if (journal_compact_request || journal_seq - journal_head >= CONFIG_JOURNAL_SEGMENTS)
+        journal_write_snapshot();
+    xSemaphoreGive(journal_mutex);
+}
+
+void mod_journal_compact(void)
+{
+    journal_compact_request = 1;
+}
+
+int mod_journal_restored(void)
+{
+    return journal_restored;
+}
+
+static void journal_task(void *parameter)
+{
+    int elapsed = 0;
+
+    for (;;) {
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+        elapsed++;
+        if (elapsed < CONFIG_JOURNAL_INTERVAL && journal_pending_count < JOURNAL_PENDING / 2 && journal_compact_request == 0)
+            continue;
+        elapsed = 0;
+
+        mod_journal_flush();
+    }
+}
+
+esp_err_t mod_journal_open(const char *name, nvs_handle *handle)
+{
+    static esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if (err != ESP_OK) {
+        err = nvs_flash_init_partition("journal");
+        if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
+            nvs_flash_erase_partition("journal");
+            err = nvs_flash_init_partition("journal");
+        }
+        if (err != ESP_OK)
+            return err;
+    }
+
+    return nvs_open_from_partition("journal", name, NVS_READWRITE, handle);
+}
+
+void mod_journal(void)
+{
+    esp_err_t err = mod_journal_open("journal", &journal_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS (%d)", err);
+        return;
+    }
+
+    journal_replay();
+
+    journal_mutex = xSemaphoreCreateMutex();
+    xTaskCreate(&journal_task, "journal", 3072, NULL, 4, NULL);
+}
+
+void mod_journal_http_handler(httpd_req_t *req)
+{
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Journal Segments : %u (%u written)<br>", journal_seq - journal_tail, journal_segments);
+    mod_webserver_printf(req, "Journal Compactions : %u<br>", journal_compactions);
+    if (journal_compact_failed)
+        mod_webserver_printf(req, "<b>Journal Compaction Failed : %d times, %d segments left</b><br>", journal_compact_failed, JOURNAL_REPLAY - (int)(journal_seq - journal_tail));
+    mod_webserver_printf(req, "Journal Dropped : %u<br>", journal_dropped);
+    mod_webserver_printf(req, "Journal Replay : %u segments in %u ms<br>", journal_replay_segments, journal_replay_ms);
+    mod_webserver_printf(req, "Journal Wear : %u kB<br>", (uint32_t)(journal_bytes / 1024));
+    mod_webserver_printf(req, "</p>");
+}
@@ -0,0 +1,36 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _MOD_JOURNAL_H_
+#define _MOD_JOURNAL_H_
+
+#include <stdint.h>
+
+#include <esp_http_server.h>
+#include <nvs.h>
+
+/* Callers hold the meter lock and portENTER_CRITICAL() around the store update and this call */
+void mod_journal_add(int channel, uint32_t hour, uint32_t count, int tagged);
+/* Same, with the counter reading the counts added so far were booked up to */
+void mod_journal_reading(int channel, uint32_t reading);
+/* Returns 0 while no reading was booked, or restored from flash */
+int mod_journal_booked(int channel, uint32_t *reading);
+
+void mod_journal_flush(void);
+void mod_journal_compact(void);
+int mod_journal_restored(void);
+
+/* Opens a namespace in the "journal" partition, which the first call initializes */
+esp_err_t mod_journal_open(const char *name, nvs_handle *handle);
+
+void mod_journal(void);
+
+void mod_journal_http_handler(httpd_req_t *req);
+
+#endif
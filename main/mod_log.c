@@ -49,6 +49,12 @@ void mod_log(void)
     orig_putchar = esp_log_set_putchar(mod_putchar);
 }
 
+// Keeps the log on the web page only, for when UART0 serves something else
+void mod_log_quiet(void)
+{
+    orig_putchar = NULL;
+}
+
 void mod_log_http_handler(httpd_req_t *req)
 {
     mod_webserver_printf(req, "<p>");
@@ -16,6 +16,7 @@ extern unsigned char LOG_BUFFER[8][128];
 extern unsigned char LOG_INDEX;
 
 void mod_log(void);
+void mod_log_quiet(void);
 
 void mod_log_http_handler(httpd_req_t *req);
 
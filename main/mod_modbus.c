@@ -0,0 +1,194 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "meter_modbus.h"
+#include "mod_log.h"
+#include "mod_modbus.h"
+#include "mod_watt_hour_meter.h"
+#include "mod_web_server.h"
+
+/* Modbus RTU master on UART0, swapped to GPIO13 (RX) and GPIO15 (TX)
+   since GPIO3 serves the BME680. Every CONFIG_MODBUS_POLL ms all batches
+   of the register map are read in turn. After a complete poll the "import"
+   register (kWh) feeds the "modbus" channel of the meter at 1000 imp/kWh,
+   one pulse per Wh, and the "power" register (W) becomes its power. The
+   journal keeps the reading booked last with the counts, so the first
+   poll after a reboot books what the meter counted in between. The very
+   first reading and a counter going backwards only set the baseline, and
+   while the clock is unset the energy waits in the meter's own counter. */
+
+#define MODBUS_UART UART_NUM_0
+#define MODBUS_TIMEOUT 200
+
+uint32_t MODBUS_READS;
+uint32_t MODBUS_CRC_ERRORS;
+uint32_t MODBUS_EXCEPTIONS;
+uint32_t MODBUS_TIMEOUTS;
+uint32_t MODBUS_LATENCY_MAX;
+
+static meter_modbus_t modbus;
+static uint64_t modbus_latency_sum;
+static uint32_t modbus_latency_count;
+static int modbus_channel = -1;
+
+static const char * const TAG = "MODBUS";
+
+static int modbus_read(int batch)
+{
+    uint8_t frame[METER_MODBUS_FRAME];
+    int length = meter_modbus_request(&modbus, batch, frame);
+    int expected = meter_modbus_response_length(&modbus, batch);
+
+    uart_flush_input(MODBUS_UART);
+    if (CONFIG_MODBUS_DE_GPIO >= 0)
+        gpio_set_level(CONFIG_MODBUS_DE_GPIO, 1);
+    int64_t start = esp_timer_get_time();
+    uart_write_bytes(MODBUS_UART, (const char *)frame, length);
+    uart_wait_tx_done(MODBUS_UART, MODBUS_TIMEOUT / portTICK_PERIOD_MS);
+    if (CONFIG_MODBUS_DE_GPIO >= 0)
+        gpio_set_level(CONFIG_MODBUS_DE_GPIO, 0);
+
+    int received = uart_read_bytes(MODBUS_UART, frame, expected, MODBUS_TIMEOUT / portTICK_PERIOD_MS);
+    uint32_t latency = esp_timer_get_time() - start;
+    MODBUS_READS++;
+
+    int result = meter_modbus_response(&modbus, batch, frame, received > 0 ? received : 0);
+    switch (result) {
+    case METER_MODBUS_OK:
+        modbus_latency_sum += latency;
+        modbus_latency_count++;
+        if (latency > MODBUS_LATENCY_MAX)
+            MODBUS_LATENCY_MAX = latency;
+        break;
+    case METER_MODBUS_CRC:
+        MODBUS_CRC_ERRORS++;
+        break;
+    case METER_MODBUS_EXCEPTION:
+        MODBUS_EXCEPTIONS++;
+        break;
+    default:
+        MODBUS_TIMEOUTS++;
+        break;
+    }
+
+    return result;
+}
+
+static void modbus_energy(void)
+{
+    int energy = meter_modbus_find(&modbus, "import");
+    int power = meter_modbus_find(&modbus, "power");
+
+    if (modbus_channel < 0 || energy < 0)
+        return;
+
+    int32_t wh = modbus.registers[energy].value;
+    if (wh < 0)
+        return;
+    mod_watt_hour_meter_reading(modbus_channel, wh, power >= 0 ? modbus.registers[power].value : 0);
+}
+
+static void modbus_task(void *parameter)
+{
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelayUntil(&wake, CONFIG_MODBUS_POLL / portTICK_PERIOD_MS);
+
+        int complete = 1;
+        for (int i = 0; i < modbus.batch_count; ++i) {
+            if (modbus_read(i) != METER_MODBUS_OK)
+                complete = 0;
+        }
+        if (complete)
+            modbus_energy();
+    }
+}
+
+int mod_modbus_json(char *json)
+{
+    char *begin = json;
+
+    for (int i = 0; i < modbus.count; ++i) {
+        int32_t value = modbus.registers[i].value;
+        int32_t magnitude = value < 0 ? -value : value;
+        json += sprintf(json, ",\"%s\":%s%d.%03d", modbus.registers[i].name, value < 0 ? "-" : "", magnitude / 1000, magnitude % 1000);
+    }
+
+    return json - begin;
+}
+
+void mod_modbus(void)
+{
+    if (CONFIG_MODBUS_MAP[0] == 0)
+        return;
+    if (meter_modbus_parse(&modbus, CONFIG_MODBUS_SLAVE, CONFIG_MODBUS_MAP) != 0) {
+        ESP_LOGE(TAG, "Invalid register map %s", CONFIG_MODBUS_MAP);
+        return;
+    }
+    modbus_channel = mod_watt_hour_meter_external("modbus");
+    ESP_LOGI(TAG, "%d registers in %d reads, channel %d", modbus.count, modbus.batch_count, modbus_channel);
+
+    // The bus takes over UART0, the log stays on the web page
+    mod_log_quiet();
+    uart_config_t uart_config = {
+        .baud_rate = CONFIG_MODBUS_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    uart_param_config(MODBUS_UART, &uart_config);
+    uart_driver_install(MODBUS_UART, 2 * METER_MODBUS_FRAME, 0, 0, NULL, 0);
+    uart_enable_swap();
+    if (CONFIG_MODBUS_DE_GPIO >= 0) {
+        gpio_set_direction(CONFIG_MODBUS_DE_GPIO, GPIO_MODE_OUTPUT);
+        gpio_set_level(CONFIG_MODBUS_DE_GPIO, 0);
+    }
+
+    xTaskCreate(&modbus_task, "modbus_task", 2048, NULL, 5, NULL);
+}
+
+void mod_modbus_http_handler(httpd_req_t *req)
+{
+    if (modbus.count == 0)
+        return;
+
+    mod_webserver_printf(req, "%s", "<table style=\"width:100%\" border='1'>");
+    mod_webserver_printf(req, "<tr><th>Modbus</th><th>Value</th></tr>");
+    for (int i = 0; i < modbus.count; ++i) {
+        int32_t value = modbus.registers[i].value;
+        int32_t magnitude = value < 0 ? -value : value;
+        mod_webserver_printf(req, "<tr><th>%s</th><th>%s%d.%03d</th></tr>", modbus.registers[i].name,
+                                  value < 0 ? "-" : "", magnitude / 1000, magnitude % 1000);
+    }
+    mod_webserver_printf(req, "</table>");
+
+    // CRC errors in 1/1000 of the reads
+    uint32_t reads = MODBUS_READS ? MODBUS_READS : 1;
+    uint32_t average = modbus_latency_count ? modbus_latency_sum / modbus_latency_count : 0;
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Modbus Reads : %u in %d batches<br>", MODBUS_READS, modbus.batch_count);
+    mod_webserver_printf(req, "Modbus Errors : %u CRC (%u.%u%%), %u exception, %u timeout<br>", MODBUS_CRC_ERRORS,
+                              MODBUS_CRC_ERRORS * 1000 / reads / 10, MODBUS_CRC_ERRORS * 1000 / reads % 10,
+                              MODBUS_EXCEPTIONS, MODBUS_TIMEOUTS);
+    mod_webserver_printf(req, "Modbus Latency : %u us average, %u us max<br>", average, MODBUS_LATENCY_MAX);
+    mod_webserver_printf(req, "</p>");
+}
@@ -0,0 +1,30 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _MOD_MODBUS_H_
+#define _MOD_MODBUS_H_
+
+#include <stdint.h>
+
+#include <esp_http_server.h>
+
+extern uint32_t MODBUS_READS;
+extern uint32_t MODBUS_CRC_ERRORS;
+extern uint32_t MODBUS_EXCEPTIONS;
+extern uint32_t MODBUS_TIMEOUTS;
+extern uint32_t MODBUS_LATENCY_MAX;
+
+/* Appends ,"name":value for each register, returns the length */
+int mod_modbus_json(char *json);
+
+void mod_modbus(void);
+
+void mod_modbus_http_handler(httpd_req_t *req);
+
+#endif
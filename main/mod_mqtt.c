@@ -17,7 +17,10 @@
 #include <esp_wifi.h>
 #include <mqtt_client.h>
 
+#include "meter_time.h"
 #include "mod_bme680.h"
+#include "mod_journal.h"
+#include "mod_modbus.h"
 #include "mod_watt_hour_meter.h"
 #include "mod_mqtt.h"
 
@@ -28,21 +31,35 @@ static esp_mqtt_client_handle_t MQTT_CLIENT;
 
 static const char * const TAG = "MQTT";
 
+static void mqtt_topic(char *topic, int channel)
+{
+    if (channel == 0)
+        strcpy(topic, MQTT_NAME);
+    else
+        sprintf(topic, "%s/%d", MQTT_NAME, channel + 1);
+}
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
     esp_mqtt_client_handle_t client = event->client;
     char topic[64];
+    char value[16];
+    int channel;
     int msg_id;
 
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
 
-            msg_id = esp_mqtt_client_subscribe(client, MQTT_NAME, 0);
-            ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+            for (int i = 0; i < mod_watt_hour_meter_channels(); ++i) {
+                mqtt_topic(topic, i);
 
-            msg_id = esp_mqtt_client_unsubscribe(client, MQTT_NAME);
-            ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
+                msg_id = esp_mqtt_client_subscribe(client, topic, 0);
+                ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+                msg_id = esp_mqtt_client_unsubscribe(client, topic);
+                ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
+            }
 
             MQTT_CLIENT = client;
             break;
@@ -71,6 +88,17 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
             msg_id = esp_mqtt_client_publish(client, topic, (char*)AREA_NAME, 0, 0, 1);
             ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
 
+            sprintf(topic, "%s/channels_off", MQTT_NAME);
+            sprintf(value, "%u", PULSE_CHANNELS_FAILED);
+            msg_id = esp_mqtt_client_publish(client, topic, value, 0, 0, 1);
+            ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+
+            for (int i = 1; i < mod_watt_hour_meter_channels(); ++i) {
+                sprintf(topic, "%s/%d/name", MQTT_NAME, i + 1);
+                msg_id = esp_mqtt_client_publish(client, topic, mod_watt_hour_meter_name(i), 0, 0, 1);
+                ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+            }
+
             MQTT_INIT = 1;
             break;
         case MQTT_EVENT_PUBLISHED:
@@ -79,7 +107,15 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
         case MQTT_EVENT_DATA:
             ESP_LOGI(TAG, "MQTT_EVENT_DATA");
             
-            if (event->data_len != 0 && MQTT_DATA == 0) {
+            channel = -1;
+            for (int i = 0; i < mod_watt_hour_meter_channels(); ++i) {
+                mqtt_topic(topic, i);
+                if (event->topic_len == strlen(topic) && strncmp(event->topic, topic, event->topic_len) == 0)
+                    channel = i;
+            }
+
+            // The retained state is only a fallback for a device without a journal
+            if (event->data_len != 0 && channel >= 0 && (MQTT_DATA & (1 << channel)) == 0 && mod_journal_restored() == 0) {
                 char *data = malloc(event->data_len + 1);
                 if (data) {
                     memcpy(data, event->data, event->data_len);
@@ -116,7 +152,10 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
                             int day = atoi(json_day);
                             if (day == timeinfo.tm_mday) {
                                 for (int i = 0; i < 24; ++i) {
-                                    PULSE_PER_HOUR[day][i] += atoi(step);
+                                    timeinfo.tm_hour = i;
+                                    timeinfo.tm_min = 0;
+                                    if (atoi(step) > 0)
+                                        mod_watt_hour_meter_add(channel, meter_time_minute(&timeinfo), atoi(step), 0);
                                     step = strtok_r(NULL, ",", &token);
                                     if (step == NULL)
                                         break;
@@ -128,7 +167,8 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
                 }
             }
 
-            MQTT_DATA = 1;
+            if (channel >= 0)
+                MQTT_DATA |= (1 << channel);
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -148,86 +188,84 @@ void mod_mqtt_publish(void)
     time(&now);
     localtime_r(&now, &timeinfo);
 
-    char data[512];
-    if (BME680_TIMESTAMP == 0) {
-        sprintf(data, "{"
-                      "\"day\":%d,"
-                      "\"power\":%.2f,"
-                      "\"values\":[%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d]"
-                      "}", timeinfo.tm_mday,
-                           (60.0 * 60.0 * 1000.0 * 1000.0 * 1000.0) / (CURRENT_TIME - PREVIOUS_TIME) / CONFIG_IMP_KWH,
-                           PULSE_PER_HOUR[timeinfo.tm_mday][0],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][1],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][2],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][3],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][4],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][5],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][6],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][7],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][8],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][9],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][10],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][11],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][12],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][13],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][14],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][15],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][16],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][17],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][18],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][19],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][20],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][21],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][22],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][23]);
-    }
-    else {
-        sprintf(data, "{"
-                      "\"day\":%d,"
-                      "\"power\":%.2f,"
-                      "\"values\":[%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d],"
-                      "\"temperature\":%.2f,"
-                      "\"humidity\":%.2f,"
-                      "\"pressure\":%.2f,"
-                      "\"gas_resistance\":%.2f,"
-                      "\"air_quality\":%.2f,"
-                      "\"co2\":%.2f,"
-                      "\"breath_voc\":%.2f"
-                      "}", timeinfo.tm_mday,
-                           (60.0 * 60.0 * 1000.0 * 1000.0 * 1000.0) / (CURRENT_TIME - PREVIOUS_TIME) / CONFIG_IMP_KWH,
-                           PULSE_PER_HOUR[timeinfo.tm_mday][0],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][1],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][2],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][3],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][4],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][5],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][6],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][7],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][8],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][9],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][10],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][11],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][12],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][13],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][14],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][15],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][16],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][17],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][18],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][19],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][20],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][21],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][22],
-                           PULSE_PER_HOUR[timeinfo.tm_mday][23],
-                           BME680_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
-                           BME680_SENSOR_HEAT_COMPENSATED_HUMIDITY,
-                           BME680_RAW_PRESSURE,
-                           BME680_RAW_GAS,
-                           BME680_STATIC_IAQ,
-                           BME680_CO2_EQUIVALENT,
-                           BME680_BREATH_VOC_EQUIVALENT);
+    for (int channel = 0; channel < mod_watt_hour_meter_channels(); ++channel) {
+        int32_t power = mod_watt_hour_meter_power(channel);
+        meter_demand_t demand;
+        int32_t projected = mod_watt_hour_meter_demand(channel, &demand);
+        meter_store_totals_t totals;
+        uint32_t hours[24];
+        char topic[64];
+        char data[768];
+        char *json = data;
+
+        mod_watt_hour_meter_totals(channel, &totals);
+        uint32_t cost = mod_watt_hour_meter_cost(channel, totals.day_cost);
+        uint32_t forecast_day, forecast_month;
+        mod_watt_hour_meter_forecast(channel, &forecast_day, &forecast_month);
+        int alarm = 0;
+        uint32_t base = mod_watt_hour_meter_base(channel, &alarm);
+        json += sprintf(json, "{"
+                              "\"day\":%d,"
+                              "\"power\":%d.%02d,"
+                              "\"demand\":%d.%02d,"
+                              "\"cost\":%u.%02u,"
+                              "\"forecast\":%u.%02u,"
+                              "\"forecast_month\":%u.%02u,"
+                              "\"base\":%u,"
+                              "\"alarm\":%d,"
+                              "\"values\":[", timeinfo.tm_mday,
+                                             power / 1000, power % 1000 / 10,
+                                             projected / 1000000, projected / 10000 % 100,
+                                             cost / 1000, cost % 1000 / 10,
+                                             forecast_day / 1000, forecast_day % 1000 / 10,
+                                             forecast_month / 1000, forecast_month % 1000 / 10,
+                                             base / 1000, alarm);
+        mod_watt_hour_meter_hours(channel, meter_time_days(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday), hours);
+        for (int i = 0; i < 24; ++i) {
+            json += sprintf(json, "%s%u", i ? "," : "", hours[i]);
+        }
+        json += sprintf(json, "]");
+        if (channel == mod_watt_hour_meter_external("modbus"))
+            json += mod_modbus_json(json);
+        if (channel == 0 && BME680_TIMESTAMP != 0) {
+            json += sprintf(json, ","
+                                  "\"temperature\":%.2f,"
+                                  "\"humidity\":%.2f,"
+                                  "\"pressure\":%.2f,"
+                                  "\"gas_resistance\":%.2f,"
+                                  "\"air_quality\":%.2f,"
+                                  "\"co2\":%.2f,"
+                                  "\"breath_voc\":%.2f", BME680_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
+                                                        BME680_SENSOR_HEAT_COMPENSATED_HUMIDITY,
+                                                        BME680_RAW_PRESSURE,
+                                                        BME680_RAW_GAS,
+                                                        BME680_STATIC_IAQ,
+                                                        BME680_CO2_EQUIVALENT,
+                                                        BME680_BREATH_VOC_EQUIVALENT);
+        }
+        json += sprintf(json, "}");
+
+        mqtt_topic(topic, channel);
+        esp_mqtt_client_publish(MQTT_CLIENT, topic, data, 0, 0, 1);
     }
-    esp_mqtt_client_publish(MQTT_CLIENT, MQTT_NAME, data, 0, 0, 1);
+}
+
+void mod_mqtt_event(int channel, time_t time, int32_t delta)
+{
+    if (MQTT_CLIENT == 0 || MQTT_INIT == 0)
+        return;
+
+    char topic[64];
+    char data[64];
+    int32_t magnitude = delta < 0 ? -delta : delta;
+
+    mqtt_topic(topic, channel);
+    strcat(topic, "/event");
+    sprintf(data, "{"
+                  "\"time\":%ld,"
+                  "\"delta\":%s%d.%02d"
+                  "}", (long)time, delta < 0 ? "-" : "", magnitude / 1000000, magnitude / 10000 % 100);
+    esp_mqtt_client_publish(MQTT_CLIENT, topic, data, 0, 0, 0);
 }
 
 void mod_mqtt(void)
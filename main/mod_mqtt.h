@@ -10,7 +10,11 @@
 #ifndef _MOD_MQTT_H_
 #define _MOD_MQTT_H_
 
+#include <stdint.h>
+#include <time.h>
+
 void mod_mqtt_publish(void);
+void mod_mqtt_event(int channel, time_t time, int32_t delta);
 
 void mod_mqtt(void);
 
@@ -15,8 +15,10 @@
 #include <esp_ota_ops.h>
 #include <esp_http_server.h>
 
+#include "mod_journal.h"
 #include "mod_log.h"
 #include "mod_ota.h"
+#include "mod_watt_hour_meter.h"
 
 #define BUFFSIZE 1500
 #define TEXT_BUFFSIZE 1024
@@ -348,7 +350,9 @@ static void ota_task(void *parameter)
 
     /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
     esp_ota_handle_t update_handle = 0 ;
+    mod_watt_hour_meter_flash_begin();
     esp_err_t err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
+    mod_watt_hour_meter_flash_end();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_begin failed, error=%d", err);
         ota_http_log();
@@ -380,7 +384,9 @@ static void ota_task(void *parameter)
             memcpy(ota_write_data, esp_ota_firm_get_write_buf(&ota_firm), esp_ota_firm_get_write_bytes(&ota_firm));
             buff_len = esp_ota_firm_get_write_bytes(&ota_firm);
 
+            mod_watt_hour_meter_flash_begin();
             err = esp_ota_write( update_handle, (const void *)ota_write_data, buff_len);
+            mod_watt_hour_meter_flash_end();
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "Error: esp_ota_write failed! err=0x%x", err);
                 ota_http_log();
@@ -419,6 +425,7 @@ static void ota_task(void *parameter)
     }
     ESP_LOGI(TAG, "Prepare to restart system!");
     ota_http_log();
+    mod_journal_flush();
     esp_restart();
     return;
 }
@@ -0,0 +1,142 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <esp_log.h>
+#include <nvs.h>
+
+#include "meter_tariff.h"
+#include "mod_tariff.h"
+#include "mod_watt_hour_meter.h"
+#include "mod_web_server.h"
+
+/* The tariff table comes from CONFIG_TARIFF until one is set at runtime
+   with /tariff?table=..., which is kept in the "tariff" NVS namespace. */
+
+static meter_tariff_t tariff;
+static char tariff_text[METER_TARIFF_TEXT];
+
+static const char * const TAG = "TARIFF";
+
+uint32_t mod_tariff_price(int32_t minute)
+{
+    return meter_tariff_price(&tariff, minute);
+}
+
+int mod_tariff_set(const char *text)
+{
+    meter_tariff_t *compiled = malloc(sizeof(meter_tariff_t));
+
+    if (compiled == NULL)
+        return -1;
+    if (strlen(text) >= METER_TARIFF_TEXT || meter_tariff_parse(compiled, text) != 0) {
+        ESP_LOGE(TAG, "Invalid tariff %s", text);
+        free(compiled);
+        return -1;
+    }
+
+    // Pulses before the swap keep the price they were counted at
+    mod_watt_hour_meter_lock();
+    tariff = *compiled;
+    strcpy(tariff_text, text);
+    mod_watt_hour_meter_unlock();
+    free(compiled);
+
+    nvs_handle handle;
+    if (nvs_open("tariff", NVS_READWRITE, &handle) == ESP_OK) {
+        mod_watt_hour_meter_flash_begin();
+        nvs_set_str(handle, "table", text);
+        nvs_commit(handle);
+        mod_watt_hour_meter_flash_end();
+        nvs_close(handle);
+    }
+
+    return 0;
+}
+
+void mod_tariff(void)
+{
+    nvs_handle handle;
+    size_t size = sizeof(tariff_text);
+
+    strcpy(tariff_text, CONFIG_TARIFF);
+    if (nvs_open("tariff", NVS_READONLY, &handle) == ESP_OK) {
+        if (nvs_get_str(handle, "table", tariff_text, &size) != ESP_OK)
+            strcpy(tariff_text, CONFIG_TARIFF);
+        nvs_close(handle);
+    }
+
+    if (meter_tariff_parse(&tariff, tariff_text) != 0) {
+        ESP_LOGE(TAG, "Invalid tariff %s", tariff_text);
+        tariff_text[0] = 0;
+        meter_tariff_parse(&tariff, tariff_text);
+    }
+}
+
+static void tariff_decode(char *text)
+{
+    char *out = text;
+
+    for (; *text != 0; ++text) {
+        if (*text == '%' && text[1] != 0 && text[2] != 0) {
+            char hex[3] = { text[1], text[2], 0 };
+            *out++ = (char)strtol(hex, NULL, 16);
+            text += 2;
+        } else {
+            *out++ = *text;
+        }
+    }
+    *out = 0;
+}
+
+static esp_err_t tariff_get_handler(httpd_req_t *req)
+{
+    char query[METER_TARIFF_TEXT * 3 + 8];
+    char table[METER_TARIFF_TEXT * 3];
+    int err = -1;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "table", table, sizeof(table)) == ESP_OK) {
+        tariff_decode(table);
+        err = mod_tariff_set(table);
+    }
+
+    mod_webserver_printf(req, "<!DOCTYPE html>");
+    mod_webserver_printf(req, "<html>");
+    mod_webserver_printf(req, "<body>");
+    mod_webserver_printf(req, "<p>%s</p>", err == 0 ? "Tariff updated" : "Invalid tariff");
+    mod_webserver_printf(req, "<a href=\"/\">Back</a>");
+    mod_webserver_printf(req, "</body>");
+    mod_webserver_printf(req, "</html>");
+    mod_webserver_printf(req, "", 0);
+
+    return ESP_OK;
+}
+
+static httpd_uri_t tariff_uri = {
+    .uri        = "/tariff",
+    .method     = HTTP_GET,
+    .handler    = tariff_get_handler,
+};
+
+void mod_tariff_start(httpd_handle_t server)
+{
+    httpd_register_uri_handler(server, &tariff_uri);
+}
+
+void mod_tariff_http_handler(httpd_req_t *req)
+{
+    mod_webserver_printf(req, "<form action=\"/tariff\">");
+    mod_webserver_printf(req, "Tariff : <input name=\"table\" size=\"64\" value=\"");
+    mod_webserver_printf(req, "%s", tariff_text);
+    mod_webserver_printf(req, "\"> <input type=\"submit\" value=\"Set\">");
+    mod_webserver_printf(req, "</form>");
+}
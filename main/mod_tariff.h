@@ -0,0 +1,27 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _MOD_TARIFF_H_
+#define _MOD_TARIFF_H_
+
+#include <stdint.h>
+
+#include <esp_http_server.h>
+
+/* Callers hold the meter lock */
+uint32_t mod_tariff_price(int32_t minute);
+
+int mod_tariff_set(const char *text);
+
+void mod_tariff(void);
+void mod_tariff_start(httpd_handle_t server);
+
+void mod_tariff_http_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,818 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_http_client.h>
+#include <nvs.h>
+
+#include "meter_form.h"
+#include "meter_queue.h"
+#include "meter_time.h"
+#include "meter_upload.h"
+#include "mod_bme680.h"
+#include "mod_https.h"
+#include "mod_journal.h"
+#include "mod_upload.h"
+#include "mod_watt_hour_meter.h"
+#include "mod_web_server.h"
+
+/* Store-and-forward of the uploads to every configured backend:
+
+   - Forms    : the day of every channel, queued at each closed hour
+   - InfluxDB : line protocol of the minute buckets of all channels and
+                the latest BME680 reading, queued every UPLOAD_INTERVAL
+   - JSON     : the same batch as one JSON object
+
+   The queue is kept in the "upload" namespace of the journal partition,
+   a blob "q<slot>" per record and head and count in "head", so queueing a
+   record or consuming a chunk writes that 12-byte record and at most the
+   one value, not the whole 0.8 KB queue. Queueing only marks the slot
+   and notifies upload_task, which writes the flash, so mod_upload_boundary
+   costs pulse_task a copy under upload_mutex; a reset before upload_task
+   ran loses the record. upload_task sends the queue oldest first. A failure leaves the record at the head and retries
+   after an exponential backoff between CONFIG_UPLOAD_BACKOFF_MIN and
+   CONFIG_UPLOAD_BACKOFF_MAX seconds, half of it random so devices behind
+   one outage don't return in step. A 4xx but 408 and 429 would come back
+   on every retry and block the records of the other backends behind it,
+   so the chunk is dropped instead. A record is only removed once the
+   server answered, so a reboot resends at most the chunk in flight.
+
+   A record is due UPLOAD_WINDOW seconds at most after it was queued, at
+   an offset derived from the MAC, so a fleet spreads its requests over
+   the window instead of all hitting the sink at the top of the hour. The
+   window is capped at the upload interval, so every hour or interval is
+   first tried before the next one closes.
+
+   Records continuing one another merge, so after an outage each backend
+   holds one span per channel. A Forms span is sent a day per request, the
+   others in chunks of up to METER_UPLOAD_MINUTES minutes whose body fits
+   in CONFIG_HTTP_BUF_SIZE, and each acknowledged chunk is consumed from
+   the head. Minutes that fell out of the minute ring while they waited
+   go as hour buckets, a day at most per request, each the hour of the
+   store less its minutes still in the ring, which follow as minutes. Only
+   what the hour store no longer has is dropped, and the rest of an hour
+   a span starts in, which a bucket cannot split.
+
+   The store counts local minutes. A chunk takes the UTC epoch of its
+   first minute from meter_time_epoch and ends at a change of the UTC
+   offset, so a backlog across a DST change keeps its timestamps.
+
+   Each backend POSTs on its own client that is kept between uploads, the
+   body streamed through meter_form so that the uploader allocates nothing
+   once the client exists. Only a request that could not be sent on a kept
+   connection is sent again on a new one; a request the server may have
+   received is failed and stays queued rather than sent twice. An https:// backend goes
+   through mod_https instead, one connection per request that resumes the
+   TLS session of the previous one, and is disabled when mod_https has no
+   trust anchor.
+
+   UPLOAD_HEAP_DELTA is the free heap lost over the last upload on an
+   existing client or session. It is a net change: it shows a leak or a
+   buffer kept across uploads, not the allocations freed within one, which
+   lwIP makes for every segment anyway. */
+
+uint32_t UPLOAD_SENT;
+uint32_t UPLOAD_FAILED;
+uint32_t UPLOAD_DROPPED;
+int32_t UPLOAD_HEAP_DELTA;
+
+static meter_queue_t upload_queue;
+static nvs_handle upload_handle;
+static int upload_kept;
+static uint64_t upload_dirty;
+_Static_assert(METER_QUEUE_SIZE <= 64, "upload_dirty has a bit per queue slot");
+static int upload_moved;
+static SemaphoreHandle_t upload_mutex;
+static TaskHandle_t upload_task_handle;
+static int64_t upload_next;
+static uint32_t upload_attempts;
+static uint32_t upload_offset;
+static char upload_response[64];
+static meter_upload_batch_t upload_batch;
+
+#define UPLOAD_FORMS    0
+#define UPLOAD_INFLUX   1
+#define UPLOAD_JSON     2
+
+// Open or write failed, the server has no complete request
+#define UPLOAD_STALE    ESP_ERR_INVALID_STATE
+// A 4xx that a retry gets again, e.g. a bad token or URL
+#define UPLOAD_REJECTED ESP_ERR_NOT_SUPPORTED
+
+typedef void (*upload_encode_t)(meter_form_t *form, const void *context);
+
+typedef struct upload_backend {
+    const char *name;
+    const char *url;
+    const char *content_type;
+    const char *authorization;
+    esp_http_client_handle_t client;
+    mod_https_t https;
+    int secure;
+    uint32_t requests;
+    uint32_t bytes;
+} upload_backend_t;
+
+static upload_backend_t upload_backends[] =
+{
+    { "Forms", CONFIG_FORM_URL "/forms/d/e/" CONFIG_FORM_ID "/formResponse", "application/x-www-form-urlencoded",
+      NULL },
+    { "InfluxDB", CONFIG_UPLOAD_INFLUX_URL, "text/plain; charset=utf-8",
+      sizeof(CONFIG_UPLOAD_INFLUX_TOKEN) > 1 ? "Token " CONFIG_UPLOAD_INFLUX_TOKEN : NULL },
+    { "JSON", CONFIG_UPLOAD_JSON_URL, "application/json",
+      NULL },
+};
+
+typedef struct upload_day {
+    int channel;
+    uint32_t hours[24];
+    uint32_t total;
+} upload_day_t;
+
+static const char * const CONFIG_FORM_HOUR[24] =
+{
+    CONFIG_FORM_HOUR_00,
+    CONFIG_FORM_HOUR_01,
+    CONFIG_FORM_HOUR_02,
+    CONFIG_FORM_HOUR_03,
+    CONFIG_FORM_HOUR_04,
+    CONFIG_FORM_HOUR_05,
+    CONFIG_FORM_HOUR_06,
+    CONFIG_FORM_HOUR_07,
+    CONFIG_FORM_HOUR_08,
+    CONFIG_FORM_HOUR_09,
+    CONFIG_FORM_HOUR_10,
+    CONFIG_FORM_HOUR_11,
+    CONFIG_FORM_HOUR_12,
+    CONFIG_FORM_HOUR_13,
+    CONFIG_FORM_HOUR_14,
+    CONFIG_FORM_HOUR_15,
+    CONFIG_FORM_HOUR_16,
+    CONFIG_FORM_HOUR_17,
+    CONFIG_FORM_HOUR_18,
+    CONFIG_FORM_HOUR_19,
+    CONFIG_FORM_HOUR_20,
+    CONFIG_FORM_HOUR_21,
+    CONFIG_FORM_HOUR_22,
+    CONFIG_FORM_HOUR_23,
+};
+
+static const char * const TAG = "UPLOAD";
+
+static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
+{
+    switch (evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+            break;
+        case HTTP_EVENT_ON_CONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            break;
+        case HTTP_EVENT_HEADER_SENT:
+            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            break;
+        case HTTP_EVENT_ON_DATA:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+            if (!esp_http_client_is_chunked_response(evt->client)) {
+                // Write out data
+                // printf("%.*s", evt->data_len, (char*)evt->data);
+            }
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
+            break;
+    }
+    return ESP_OK;
+}
+
+static int upload_enabled(int backend)
+{
+    if (upload_backends[backend].url[0] == 0)
+        return 0;
+    if (backend == UPLOAD_FORMS)
+        return CONFIG_FORM_ID[0] != 0;
+    return 1;
+}
+
+static int upload_write(void *context, const char *data, int length)
+{
+    return esp_http_client_write(context, data, length);
+}
+
+static esp_err_t upload_status(int status)
+{
+    if (status >= 200 && status < 400)
+        return ESP_OK;
+    // Timeouts and rate limits pass
+    if (status >= 400 && status < 500 && status != 408 && status != 429)
+        return UPLOAD_REJECTED;
+    return ESP_FAIL;
+}
+
+static esp_err_t upload_post(upload_backend_t *backend, upload_encode_t encode, const void *context)
+{
+    meter_form_t form;
+
+    // Length
+    meter_form_init(&form, NULL, NULL);
+    encode(&form, context);
+    int32_t length = meter_form_finish(&form);
+
+    if (esp_http_client_open(backend->client, length) != ESP_OK)
+        return UPLOAD_STALE;
+
+    // Body, incomplete on the server if a write fails
+    meter_form_init(&form, upload_write, backend->client);
+    encode(&form, context);
+    if (meter_form_finish(&form) != length)
+        return UPLOAD_STALE;
+
+    if (esp_http_client_fetch_headers(backend->client) < 0)
+        return ESP_FAIL;
+
+    // Drain the response so the connection can be kept
+    while (esp_http_client_read(backend->client, upload_response, sizeof(upload_response)) > 0);
+
+    backend->requests++;
+    backend->bytes += length;
+
+    int status = esp_http_client_get_status_code(backend->client);
+    ESP_LOGI(TAG, "%s %d B Status = %d", backend->name, length, status);
+    return upload_status(status);
+}
+
+static esp_err_t upload_post_https(upload_backend_t *backend, upload_encode_t encode, const void *context)
+{
+    mod_https_t *https = &backend->https;
+    meter_form_t form;
+
+    // Length
+    meter_form_init(&form, NULL, NULL);
+    encode(&form, context);
+    int32_t length = meter_form_finish(&form);
+
+    if (mod_https_open(https) != ESP_OK)
+        return ESP_FAIL;
+
+    // Request
+    meter_form_init(&form, mod_https_write, https);
+    meter_form_text(&form, "POST ");
+    meter_form_text(&form, https->path);
+    meter_form_text(&form, " HTTP/1.1\r\nHost: ");
+    meter_form_text(&form, https->host);
+    if (strcmp(https->port, "443") != 0) {
+        meter_form_text(&form, ":");
+        meter_form_text(&form, https->port);
+    }
+    meter_form_text(&form, "\r\nContent-Type: ");
+    meter_form_text(&form, backend->content_type);
+    if (backend->authorization) {
+        meter_form_text(&form, "\r\nAuthorization: ");
+        meter_form_text(&form, backend->authorization);
+    }
+    meter_form_text(&form, "\r\nContent-Length: ");
+    meter_form_decimal(&form, length, 0);
+    meter_form_text(&form, "\r\nConnection: close\r\n\r\n");
+    encode(&form, context);
+    if (meter_form_finish(&form) < 0) {
+        mod_https_close(https);
+        return ESP_FAIL;
+    }
+
+    int status = mod_https_status(https);
+    mod_https_close(https);
+
+    backend->requests++;
+    backend->bytes += length;
+
+    ESP_LOGI(TAG, "%s %d B Status = %d", backend->name, length, status);
+    return upload_status(status);
+}
+
+static esp_err_t upload_send(upload_backend_t *backend, upload_encode_t encode, const void *context)
+{
+    uint32_t heap = esp_get_free_heap_size();
+    int steady = backend->client != NULL;
+
+    if (backend->secure) {
+        steady = backend->https.saved;
+        esp_err_t err = upload_post_https(backend, encode, context);
+        if (steady && backend->https.saved)
+            UPLOAD_HEAP_DELTA = (int32_t)(heap - esp_get_free_heap_size());
+        return err;
+    }
+
+    if (backend->client == NULL) {
+        esp_http_client_config_t config = {
+            .url = backend->url,
+            .method = HTTP_METHOD_POST,
+            .event_handler = _http_event_handler,
+        };
+        backend->client = esp_http_client_init(&config);
+        if (backend->client == NULL)
+            return ESP_ERR_NO_MEM;
+        esp_http_client_set_header(backend->client, "Content-Type", backend->content_type);
+        if (backend->authorization)
+            esp_http_client_set_header(backend->client, "Authorization", backend->authorization);
+    }
+
+    // A kept connection the server has closed fails to send, then reconnects
+    esp_err_t err = upload_post(backend, encode, context);
+    if (err != ESP_OK) {
+        esp_http_client_close(backend->client);
+        if (err == UPLOAD_STALE && steady)
+            err = upload_post(backend, encode, context);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error perform http request %d", err);
+            esp_http_client_close(backend->client);
+        }
+    }
+
+    if (steady)
+        UPLOAD_HEAP_DELTA = (int32_t)(heap - esp_get_free_heap_size());
+    return err;
+}
+
+// Forms
+static void upload_forms_encode(meter_form_t *form, const void *context)
+{
+    const upload_day_t *day = context;
+
+    meter_form_string(form, CONFIG_FORM_AREA, mod_watt_hour_meter_name(day->channel));
+    for (int i = 0; i < 24; ++i) {
+        meter_form_uint(form, CONFIG_FORM_HOUR[i], day->hours[i]);
+    }
+    meter_form_uint(form, CONFIG_FORM_TOTAL, day->total);
+    meter_form_string(form, "submit=", "Submit");
+}
+
+static esp_err_t upload_forms(int channel, int32_t day)
+{
+    upload_day_t upload = { .channel = channel };
+
+    // Evicted from the store, or without a pulse
+    if (mod_watt_hour_meter_hours(channel, day, upload.hours) == 0)
+        return ESP_ERR_NOT_FOUND;
+    upload.total = mod_watt_hour_meter_day(channel, day);
+
+    return upload_send(&upload_backends[UPLOAD_FORMS], upload_forms_encode, &upload);
+}
+
+// Batches
+static void upload_influx_encode(meter_form_t *form, const void *context)
+{
+    meter_upload_influx(form, context);
+}
+
+static void upload_json_encode(meter_form_t *form, const void *context)
+{
+    meter_upload_json(form, context);
+}
+
+static const upload_encode_t upload_encoders[] =
+{
+    NULL,
+    upload_influx_encode,
+    upload_json_encode,
+};
+
+// Hour buckets of a span from minute to end, up to a day, that left the minute ring at first
+static esp_err_t upload_hours(meter_upload_batch_t *batch, int32_t minute, int32_t end, int32_t first, uint16_t *sent)
+{
+    // The rest of an hour the span starts in went with the bucket before or is lost
+    if (minute % 60) {
+        int32_t next = minute - minute % 60 + 60;
+        *sent = (next < end ? next : end) - minute;
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int32_t day = minute / 1440;
+    if (end > (day + 1) * 1440)
+        end = (day + 1) * 1440;
+    *sent = end - minute;
+    batch->interval = 3600;
+    batch->buckets = (end - minute + 59) / 60;
+
+    int found = 0;
+    for (int i = 0; i < batch->channels; ++i) {
+        meter_upload_channel_t *channel = &batch->channel[i];
+        uint32_t hours[24];
+        uint16_t ring[60];
+
+        found |= mod_watt_hour_meter_hours(i, day, hours);
+        for (int h = 0; h < batch->buckets; ++h) {
+            int32_t start = minute + h * 60;
+            channel->hours[h] = hours[start / 60 % 24];
+
+            // Minutes of the hour still in the ring go as minutes
+            if (start + 60 <= first)
+                continue;
+            mod_watt_hour_meter_minutes(i, first, start + 60 - first, ring);
+            for (int m = 0; m < start + 60 - first; ++m)
+                channel->hours[h] -= ring[m] < channel->hours[h] ? ring[m] : channel->hours[h];
+        }
+    }
+
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// Sends the first minutes of a span, as many as fit in CONFIG_HTTP_BUF_SIZE,
+// in hour buckets where the minute ring no longer has them
+static esp_err_t upload_window(int backend, int32_t minute, uint16_t span, uint16_t *sent)
+{
+    meter_upload_batch_t *batch = &upload_batch;
+    struct tm timeinfo = { 0 };
+    time_t now = time(NULL);
+
+    localtime_r(&now, &timeinfo);
+    int32_t current = meter_time_minute(&timeinfo);
+
+    // A chunk keeps the UTC offset of its first minute, the next one starts at a DST change
+    span = meter_time_run(minute, span < 1440 ? span : 1440);
+    batch->device = AREA_NAME[0] ? (const char*)AREA_NAME : "ESProom";
+    batch->time = meter_time_epoch(minute);
+    batch->channels = mod_watt_hour_meter_channels();
+    if (batch->channels > METER_UPLOAD_CHANNELS)
+        batch->channels = METER_UPLOAD_CHANNELS;
+    for (int i = 0; i < batch->channels; ++i) {
+        batch->channel[i].name = mod_watt_hour_meter_name(i);
+        batch->channel[i].imp_kwh = mod_watt_hour_meter_imp(i);
+    }
+
+    int32_t first = current - METER_STORE_MINUTES + 1;
+    if (minute < first) {
+        esp_err_t err = upload_hours(batch, minute, minute + span < first ? minute + span : first, first, sent);
+        if (err != ESP_OK)
+            return err;
+    }
+    else {
+        batch->interval = 60;
+        batch->buckets = span < METER_UPLOAD_MINUTES ? span : METER_UPLOAD_MINUTES;
+        for (int i = 0; i < batch->channels; ++i) {
+            if (mod_watt_hour_meter_minutes(i, minute, batch->buckets, batch->channel[i].counts) == 0) {
+                *sent = 1;
+                return ESP_ERR_NOT_FOUND;
+            }
+        }
+        *sent = batch->buckets;
+    }
+
+    batch->environment = BME680_TIMESTAMP != 0;
+    if (batch->environment) {
+        meter_upload_environment_t *env = &batch->env;
+        env->time = now - (esp_timer_get_time() - BME680_TIMESTAMP / 1000) / (1000 * 1000);
+        env->temperature = BME680_SENSOR_HEAT_COMPENSATED_TEMPERATURE * 100;
+        env->humidity = BME680_SENSOR_HEAT_COMPENSATED_HUMIDITY * 100;
+        env->pressure = BME680_RAW_PRESSURE * 100;
+        env->gas = BME680_RAW_GAS;
+        env->iaq = BME680_STATIC_IAQ * 100;
+        env->co2 = BME680_CO2_EQUIVALENT * 100;
+        env->voc = BME680_BREATH_VOC_EQUIVALENT * 100;
+    }
+
+    // Shrink the chunk in proportion until the body fits
+    for (;;) {
+        meter_form_t form;
+        meter_form_init(&form, NULL, NULL);
+        upload_encoders[backend](&form, batch);
+        int32_t length = meter_form_finish(&form);
+        if (length <= CONFIG_HTTP_BUF_SIZE || batch->buckets == 1)
+            break;
+        uint32_t buckets = (uint32_t)batch->buckets * CONFIG_HTTP_BUF_SIZE / length;
+        batch->buckets = buckets == 0 ? 1 : buckets < batch->buckets ? buckets : batch->buckets - 1;
+    }
+
+    // The last hour bucket may end before the hour
+    uint32_t minutes = (uint32_t)batch->buckets * batch->interval / 60;
+    if (minutes < *sent)
+        *sent = minutes;
+    return upload_send(&upload_backends[backend], upload_encoders[backend], batch);
+}
+
+// With upload_mutex held, after a change of the queue from head and count
+static void upload_mark(uint16_t head, uint16_t count)
+{
+    const meter_queue_t *queue = &upload_queue;
+
+    if (queue->written < METER_QUEUE_SIZE)
+        upload_dirty |= 1ull << queue->written;
+    if (queue->head != head || queue->count != count)
+        upload_moved = 1;
+}
+
+// Writes the marked records, then head and count, each copied under upload_mutex
+static void upload_save(void)
+{
+    esp_err_t err = ESP_OK;
+    int written = 0;
+    char key[8];
+
+    while (upload_kept && err == ESP_OK) {
+        meter_queue_record_t record;
+        uint32_t head = 0;
+        int slot = -1;
+
+        // The records before the head that makes them visible
+        xSemaphoreTake(upload_mutex, portMAX_DELAY);
+        if (upload_dirty) {
+            slot = __builtin_ctzll(upload_dirty);
+            upload_dirty &= ~(1ull << slot);
+            record = upload_queue.records[slot];
+        } else if (upload_moved) {
+            upload_moved = 0;
+            head = (uint32_t)upload_queue.count << 16 | upload_queue.head;
+        } else {
+            xSemaphoreGive(upload_mutex);
+            break;
+        }
+        xSemaphoreGive(upload_mutex);
+
+        mod_watt_hour_meter_flash_begin();
+        if (slot >= 0) {
+            sprintf(key, "q%d", slot);
+            err = nvs_set_blob(upload_handle, key, &record, sizeof(record));
+        }
+        else {
+            err = nvs_set_u32(upload_handle, "head", head);
+        }
+        mod_watt_hour_meter_flash_end();
+        written = 1;
+    }
+
+    if (written && err == ESP_OK) {
+        mod_watt_hour_meter_flash_begin();
+        err = nvs_commit(upload_handle);
+        mod_watt_hour_meter_flash_end();
+    }
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Error saving the queue (%d)", err);
+}
+
+static void upload_load(void)
+{
+    meter_queue_t *queue = &upload_queue;
+    uint32_t head;
+    char key[8];
+
+    meter_queue_init(queue);
+
+    esp_err_t err = mod_journal_open("upload", &upload_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS (%d), the queue is not kept", err);
+        return;
+    }
+    upload_kept = 1;
+    if (nvs_get_u32(upload_handle, "head", &head) != ESP_OK)
+        return;
+
+    queue->head = head & 0xFFFF;
+    queue->count = head >> 16;
+    if (!meter_queue_valid(queue)) {
+        meter_queue_init(queue);
+        return;
+    }
+    for (int i = 0; i < queue->count; ++i) {
+        int slot = (queue->head + i) % METER_QUEUE_SIZE;
+        size_t size = sizeof(meter_queue_record_t);
+        sprintf(key, "q%d", slot);
+        if (nvs_get_blob(upload_handle, key, &queue->records[slot], &size) != ESP_OK || size != sizeof(meter_queue_record_t)) {
+            ESP_LOGE(TAG, "Queued upload %s is missing, queue cleared", key);
+            meter_queue_init(queue);
+            return;
+        }
+    }
+
+    if (queue->count)
+        ESP_LOGI(TAG, "%d uploads pending", queue->count);
+}
+
+// The key of a Forms record is a day, of the others a minute
+static void upload_expired(const meter_queue_record_t *record, uint16_t sent)
+{
+    int32_t minute = record->backend == UPLOAD_FORMS ? record->key * 1440 : record->key;
+    int year, month, mday;
+
+    meter_time_civil(minute / 1440, &year, &month, &mday);
+    if (record->backend == UPLOAD_FORMS)
+        ESP_LOGW(TAG, "%s %d-%02d-%02d of %s expired", upload_backends[record->backend].name, year, month, mday,
+                 mod_watt_hour_meter_name(record->channel));
+    else
+        ESP_LOGW(TAG, "%s %u min from %d-%02d-%02d %02d:%02d expired", upload_backends[record->backend].name, sent,
+                 year, month, mday, minute % 1440 / 60, minute % 60);
+}
+
+static void upload_task(void *parameter)
+{
+    for (;;) {
+        meter_queue_record_t record;
+        int pending;
+
+        upload_save();
+        xSemaphoreTake(upload_mutex, portMAX_DELAY);
+        pending = upload_queue.count;
+        if (pending)
+            record = *meter_queue_peek(&upload_queue);
+        xSemaphoreGive(upload_mutex);
+
+        // New records don't cut a backoff short
+        int64_t now = esp_timer_get_time();
+        if (pending == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (now < upload_next) {
+            ulTaskNotifyTake(pdTRUE, (upload_next - now) / 1000 / portTICK_PERIOD_MS + 1);
+            continue;
+        }
+        uint32_t wall = time(NULL);
+        if (wall < record.created + upload_offset) {
+            ulTaskNotifyTake(pdTRUE, (record.created + upload_offset - wall) * 1000 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        // One day of a Forms record, a chunk of minutes of the others
+        esp_err_t err;
+        uint16_t sent = 1;
+        if (record.backend == UPLOAD_FORMS)
+            err = upload_forms(record.channel, record.key);
+        else
+            err = upload_window(record.backend, record.key, record.span, &sent);
+
+        if (err == ESP_ERR_NOT_FOUND) {
+            upload_expired(&record, sent);
+            UPLOAD_DROPPED++;
+        } else if (err == UPLOAD_REJECTED) {
+            ESP_LOGE(TAG, "%s rejected record %d, dropped", upload_backends[record.backend].name, record.key);
+            UPLOAD_DROPPED++;
+        } else if (err != ESP_OK) {
+            upload_attempts++;
+            UPLOAD_FAILED++;
+            uint32_t delay = meter_queue_backoff(upload_attempts, CONFIG_UPLOAD_BACKOFF_MIN * 1000, CONFIG_UPLOAD_BACKOFF_MAX * 1000, esp_random());
+            upload_next = esp_timer_get_time() + (int64_t)delay * 1000;
+            ESP_LOGW(TAG, "Upload failed %u times, retry in %u s", upload_attempts, delay / 1000);
+            continue;
+        } else {
+            upload_attempts = 0;
+            UPLOAD_SENT++;
+        }
+
+        xSemaphoreTake(upload_mutex, portMAX_DELAY);
+        const meter_queue_record_t *head = meter_queue_peek(&upload_queue);
+        if (head && head->backend == record.backend && head->channel == record.channel && head->key == record.key) {
+            uint16_t first = upload_queue.head, count = upload_queue.count;
+            meter_queue_consume(&upload_queue, sent);
+            upload_mark(first, count);
+        }
+        xSemaphoreGive(upload_mutex);
+    }
+}
+
+static void upload_push(int backend, int channel, int32_t key, uint16_t span)
+{
+    meter_queue_record_t record = { 0 };
+
+    record.created = time(NULL);
+    record.key = key;
+    record.channel = channel;
+    record.backend = backend;
+    record.span = span;
+
+    xSemaphoreTake(upload_mutex, portMAX_DELAY);
+    uint16_t head = upload_queue.head, count = upload_queue.count;
+    int result = meter_queue_push(&upload_queue, &record);
+    if (result == METER_QUEUE_DROPPED)
+        UPLOAD_DROPPED++;
+    upload_mark(head, count);
+    xSemaphoreGive(upload_mutex);
+
+    xTaskNotifyGive(upload_task_handle);
+}
+
+void mod_upload_boundary(int32_t previous, int32_t minute)
+{
+    if (previous < 0)
+        return;
+
+    // The day of the hour that ended, even after a step over several days
+    if (minute / 60 != previous / 60 && upload_enabled(UPLOAD_FORMS)) {
+        for (int i = 0; i < mod_watt_hour_meter_channels(); ++i)
+            upload_push(UPLOAD_FORMS, i, previous / 1440, 1);
+    }
+
+    if (minute / CONFIG_UPLOAD_INTERVAL != previous / CONFIG_UPLOAD_INTERVAL) {
+        for (int i = UPLOAD_INFLUX; i <= UPLOAD_JSON; ++i) {
+            if (upload_enabled(i))
+                upload_push(i, 0, previous - previous % CONFIG_UPLOAD_INTERVAL, CONFIG_UPLOAD_INTERVAL);
+        }
+    }
+}
+
+uint32_t mod_upload_next(void)
+{
+    struct tm timeinfo = { 0 };
+    time_t now = time(NULL);
+    uint32_t next = 0;
+
+    xSemaphoreTake(upload_mutex, portMAX_DELAY);
+    if (upload_queue.count)
+        next = meter_queue_peek(&upload_queue)->created + upload_offset;
+    xSemaphoreGive(upload_mutex);
+
+    if (next) {
+        int64_t retry = upload_attempts ? (upload_next - esp_timer_get_time()) / (1000 * 1000) : 0;
+        if (retry > 0 && now + retry > next)
+            next = now + retry;
+        return next < now ? now : next;
+    }
+
+    // Empty, the next boundary that queues a record
+    int step = 60;
+    if (upload_enabled(UPLOAD_INFLUX) || upload_enabled(UPLOAD_JSON))
+        step = CONFIG_UPLOAD_INTERVAL;
+    else if (upload_enabled(UPLOAD_FORMS) == 0)
+        return 0;
+    localtime_r(&now, &timeinfo);
+    int32_t minute = meter_time_minute(&timeinfo);
+    return now - timeinfo.tm_sec + (step - minute % step) * 60 + upload_offset;
+}
+
+void mod_upload(void)
+{
+    uint8_t mac[6] = { 0 };
+    uint32_t window = CONFIG_UPLOAD_WINDOW;
+
+    upload_mutex = xSemaphoreCreateMutex();
+    upload_load();
+
+    for (int i = 0; i < sizeof(upload_backends) / sizeof(upload_backends[0]); ++i) {
+        upload_backend_t *backend = &upload_backends[i];
+        esp_err_t err = mod_https_init(&backend->https, backend->url);
+        backend->secure = err == ESP_OK;
+        // Never downgraded to an unverified connection
+        if (err == ESP_ERR_INVALID_STATE)
+            backend->url = "";
+    }
+
+    // Each device takes its own slot in the window
+    if (window > CONFIG_UPLOAD_INTERVAL * 60)
+        window = CONFIG_UPLOAD_INTERVAL * 60;
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    upload_offset = meter_queue_jitter(mac, window);
+    ESP_LOGI(TAG, "Upload offset %u s of %u s", upload_offset, window);
+
+    xTaskCreate(&upload_task, "upload_task", 4096, NULL, 4, &upload_task_handle);
+}
+
+void mod_upload_http_handler(httpd_req_t *req)
+{
+    int depth;
+    uint32_t oldest = 0;
+
+    xSemaphoreTake(upload_mutex, portMAX_DELAY);
+    depth = upload_queue.count;
+    if (depth)
+        oldest = time(NULL) - meter_queue_peek(&upload_queue)->created;
+    xSemaphoreGive(upload_mutex);
+
+    int64_t next = depth && upload_attempts ? (upload_next - esp_timer_get_time()) / (1000 * 1000) : 0;
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Upload Queue : %d pending, oldest %u min<br>", depth, oldest / 60);
+    mod_webserver_printf(req, "Upload : %u sent, %u failed, %u dropped, retry in %d s<br>",
+                              UPLOAD_SENT, UPLOAD_FAILED, UPLOAD_DROPPED, next > 0 ? (int)next : 0);
+    for (int i = 0; i < sizeof(upload_backends) / sizeof(upload_backends[0]); ++i) {
+        if (upload_enabled(i) == 0)
+            continue;
+        mod_webserver_printf(req, "Upload %s : %u requests, %u B<br>", upload_backends[i].name,
+                                  upload_backends[i].requests, upload_backends[i].bytes);
+    }
+    uint32_t scheduled = mod_upload_next();
+    if (scheduled) {
+        mod_webserver_printf(req, "Upload Next : in %d s, offset %u s<br>",
+                                  (int)(scheduled - time(NULL)), upload_offset);
+    }
+    mod_webserver_printf(req, "Upload Heap Delta : %d B (net)<br>", UPLOAD_HEAP_DELTA);
+    mod_webserver_printf(req, "</p>");
+}
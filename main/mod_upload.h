@@ -0,0 +1,32 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _MOD_UPLOAD_H_
+#define _MOD_UPLOAD_H_
+
+#include <stdint.h>
+
+#include <esp_http_server.h>
+
+extern uint32_t UPLOAD_SENT;
+extern uint32_t UPLOAD_FAILED;
+extern uint32_t UPLOAD_DROPPED;
+extern int32_t UPLOAD_HEAP_DELTA;
+
+/* Queues what closed between the two local minutes */
+void mod_upload_boundary(int32_t previous, int32_t minute);
+
+/* UTC time of the next scheduled attempt, 0 with no backend */
+uint32_t mod_upload_next(void);
+
+void mod_upload(void);
+
+void mod_upload_http_handler(httpd_req_t *req);
+
+#endif
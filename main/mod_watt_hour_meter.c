@@ -9,201 +9,476 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 
+#include <esp_attr.h>
 #include <esp_log.h>
+#include <esp_system.h>
 #include <esp_timer.h>
-#include <esp_http_client.h>
 #include <esp_wifi.h>
+#include <esp8266/gpio_struct.h>
+#include <driver/hw_timer.h>
 
+#include "meter_channel.h"
+#include "meter_time.h"
+#include "mod_journal.h"
 #include "mod_mqtt.h"
+#include "mod_tariff.h"
+#include "mod_upload.h"
 #include "mod_web_server.h"
 #include "mod_watt_hour_meter.h"
 
-unsigned short PULSE_PER_HOUR[32][24];
+meter_store_t *PULSE_STORE[WATT_HOUR_METER_CHANNELS];
 unsigned char AREA_NAME[16];
-int64_t CURRENT_TIME;
-int64_t PREVIOUS_TIME;
-
-static struct tm PULSE_TIMEINFO;
-
-static const char * const CONFIG_FORM_HOUR[24] =
-{
-    CONFIG_FORM_HOUR_00,
-    CONFIG_FORM_HOUR_01,
-    CONFIG_FORM_HOUR_02,
-    CONFIG_FORM_HOUR_03,
-    CONFIG_FORM_HOUR_04,
-    CONFIG_FORM_HOUR_05,
-    CONFIG_FORM_HOUR_06,
-    CONFIG_FORM_HOUR_07,
-    CONFIG_FORM_HOUR_08,
-    CONFIG_FORM_HOUR_09,
-    CONFIG_FORM_HOUR_10,
-    CONFIG_FORM_HOUR_11,
-    CONFIG_FORM_HOUR_12,
-    CONFIG_FORM_HOUR_13,
-    CONFIG_FORM_HOUR_14,
-    CONFIG_FORM_HOUR_15,
-    CONFIG_FORM_HOUR_16,
-    CONFIG_FORM_HOUR_17,
-    CONFIG_FORM_HOUR_18,
-    CONFIG_FORM_HOUR_19,
-    CONFIG_FORM_HOUR_20,
-    CONFIG_FORM_HOUR_21,
-    CONFIG_FORM_HOUR_22,
-    CONFIG_FORM_HOUR_23,
-};
+uint32_t PULSE_OVERFLOW;
+uint32_t PULSE_FLASH_BUSY;
+uint32_t PULSE_RING_PEAK;
+uint32_t PULSE_ISR_CYCLES_MAX;
+uint32_t PULSE_LATENCY_MAX;
+uint32_t PULSE_TASK_US_MAX;
+uint32_t PULSE_STRESS_GENERATED;
+uint32_t PULSE_STRESS_COUNTED;
+uint32_t PULSE_BACKFILLED;
+uint32_t PULSE_BACKLOG_DROPPED;
+uint32_t PULSE_CHANNELS_FAILED;
+
+/* Everything the pulse path touches for one channel sits in one record,
+   and the ring carries the channel index, so a pulse costs the same no
+   matter how many channels are configured. The metering itself is
+   meter_channel, this module only adds the clocks, locking and I/O.
+   PULSE_STORE points at the stores for the journal. */
+
+// GPIO of a channel fed by another source, mod_modbus or mod_ct
+#define PULSE_EXTERNAL GPIO_NUM_MAX
+static const char * const pulse_sources[] = { "modbus", "ct" };
+
+typedef struct pulse_channel {
+    meter_channel_t meter;
+    gpio_num_t gpio_num;
+    const char *source;
+    int32_t external_power;
+    uint32_t level;
+    unsigned char name[16];
+} pulse_channel_t;
+
+static pulse_channel_t pulse_channels[WATT_HOUR_METER_CHANNELS];
+static int pulse_channel_count;
+
+/* Single-producer (ISR) / single-consumer (pulse_task) ring of input edges.
+
+   High-rate budget: the ISR takes a timestamp, a GPIO read and one ring
+   store, a few hundred of the 80 MHz cycles (PULSE_ISR_CYCLES_MAX), and
+   pulse_task never blocks on the network since publishing has its own
+   task. The ring holds 128 pulses, over 2 s at 55 pulses/s, and the
+   filter accepts pulses down to 2 * PULSE_WIDTH_MIN apart. The supported
+   ceiling is 200 pulses/s summed over all channels, 10000 imp/kWh at
+   72 kW.
+
+   PULSE_STRESS_RATE checks that on a device: the hardware timer toggles
+   the GPIO of channel 0, driven as an output with the meter unplugged, so
+   the pulses take the real path through the GPIO interrupt, the ring, the
+   filter and the buckets. A compaction is requested every minute, so the
+   run also covers the journal writes and the masked flash windows. The
+   generated and counted pulses stay equal and PULSE_OVERFLOW at 0 up to
+   the ceiling. The journal copies a store under the lock and writes flash
+   without it, so pulse_task stalls for the copy only, under 100 us.
+   The highest loss-free rate has not been recorded on hardware yet; the
+   200 pulses/s above is derived from the ISR and task budgets, not from a
+   stress run. */
+#define PULSE_RING_SIZE 256
+
+/* Flash safety: erasing or writing the flash (OTA, NVS commits, Wi-Fi
+   calibration) disables its cache, so everything the ISR touches lives in
+   IRAM or DRAM. The level is read from the GPIO register rather than
+   through gpio_get_level(). The SDK masks interrupts for the length of a
+   flash write, and the edges seen by the GPIO in that window merge into
+   one interrupt. The modules writing flash mark the window with
+   mod_watt_hour_meter_flash_begin() and _end(). When an interrupt inside
+   it, or within PULSE_FLASH_SLACK after it, finds the level already
+   recorded, a pulse may have gone by unseen: PULSE_EDGE_MISSED lets the
+   filter count it when the gap fits the pulse interval, and
+   PULSE_FLASH_BUSY shows how many were recovered this way. Outside a
+   window the edge goes to the filter as it is, which rejects it. */
+#define PULSE_EDGE_MISSED METER_CHANNEL_MISSED
+#define PULSE_FLASH_SLACK 2000
+
+static volatile uint32_t pulse_flash_busy;
+static volatile uint32_t pulse_flash_end;
+
+// esp_timer time in 32 bits, rebuilt by pulse_task within 71 minutes
+typedef struct pulse_edge {
+    uint32_t time;
+    uint8_t channel;
+    uint8_t level;
+} pulse_edge_t;
+
+static volatile pulse_edge_t pulse_ring[PULSE_RING_SIZE];
+static volatile uint32_t pulse_ring_head;
+static volatile uint32_t pulse_ring_tail;
+static TaskHandle_t pulse_task_handle;
+static TaskHandle_t pulse_publish_handle;
+
+static SemaphoreHandle_t pulse_mutex;
+
+/* Pulses counted before the clock is set, merged per channel and minute
+   of esp_timer time. They land in their hour once SNTP sets the clock,
+   off by at most the one minute they were merged over. */
+#define PULSE_BACKLOG 256
+
+typedef struct pulse_backlog {
+    uint32_t second;
+    uint16_t count;
+    uint8_t channel;
+} pulse_backlog_t;
+
+static pulse_backlog_t pulse_backlog[PULSE_BACKLOG];
+static int pulse_backlog_count;
+
+// Boundary scheduler, woken by pulse_timer at every local minute
+static esp_timer_handle_t pulse_timer;
+static volatile int pulse_tick;
+static int32_t pulse_minute = -1;
 
 static const char * const TAG = "WATT-HOUR METER";
 
-static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
+static void pulse_backlog_add(int channel, int64_t pulse_time)
 {
-    switch (evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                // Write out data
-                // printf("%.*s", evt->data_len, (char*)evt->data);
-            }
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
-            break;
+    uint32_t second = pulse_time / (1000 * 1000);
+
+    // Channels interleave, so the entry to merge into is among the last few
+    for (int i = pulse_backlog_count - 1; i >= 0 && i >= pulse_backlog_count - WATT_HOUR_METER_CHANNELS; --i) {
+        pulse_backlog_t *entry = &pulse_backlog[i];
+        if (entry->channel == channel && second - entry->second < 60 && entry->count < UINT16_MAX) {
+            entry->count++;
+            return;
+        }
     }
-    return ESP_OK;
+
+    if (pulse_backlog_count >= PULSE_BACKLOG) {
+        PULSE_BACKLOG_DROPPED++;
+        return;
+    }
+
+    pulse_backlog_t *entry = &pulse_backlog[pulse_backlog_count++];
+    entry->second = second;
+    entry->count = 1;
+    entry->channel = channel;
 }
 
-static void pulse_web(void *parameter)
+static void pulse_backfill(void)
 {
-    char *HTTP_URL = malloc(1024);
-    char *http_url = HTTP_URL;
+    struct timeval tv = { 0 };
+    uint32_t count = 0;
 
-    if (HTTP_URL == NULL)
+    if (pulse_backlog_count == 0)
         return;
 
-    // URL
-    http_url += sprintf(http_url, CONFIG_FORM_URL "/forms/d/e/");
-    http_url += sprintf(http_url, CONFIG_FORM_ID);
-    http_url += sprintf(http_url, "/formResponse?usp=pp_url&");
+    // Wall clock minus esp_timer time maps every buffered pulse in one pass
+    gettimeofday(&tv, NULL);
+    int64_t offset = (int64_t)tv.tv_sec * 1000 * 1000 + tv.tv_usec - esp_timer_get_time();
 
-    // Area
-    http_url += sprintf(http_url, "%s%s&", CONFIG_FORM_AREA, AREA_NAME);
-   
-    // Pulse
-    int total = 0;
-    for (int i = 0; i < 24; ++i) {
-        total += PULSE_PER_HOUR[PULSE_TIMEINFO.tm_mday][i];
-        http_url += sprintf(http_url, "%s%d&", CONFIG_FORM_HOUR[i], PULSE_PER_HOUR[PULSE_TIMEINFO.tm_mday][i]);
+    for (int i = 0; i < pulse_backlog_count; ++i) {
+        pulse_backlog_t *entry = &pulse_backlog[i];
+        time_t when = (offset + (int64_t)entry->second * 1000 * 1000) / (1000 * 1000);
+        struct tm timeinfo = { 0 };
+
+        localtime_r(&when, &timeinfo);
+        mod_watt_hour_meter_add(entry->channel, meter_time_minute(&timeinfo), entry->count, 1);
+        count += entry->count;
     }
+    pulse_backlog_count = 0;
+    PULSE_BACKFILLED += count;
 
-    // Total
-    http_url += sprintf(http_url, "%s%d&", CONFIG_FORM_TOTAL, total);
+    ESP_LOGI(TAG, "Back-filled %u pulses", count);
+}
 
-    // Submit
-    http_url += sprintf(http_url, "submit=Submit");
-    ESP_LOGI(TAG, "%s", HTTP_URL);
+static void pulse_boundary(void)
+{
+    struct timeval tv = { 0 };
+    struct tm timeinfo = { 0 };
+    int64_t timeout = 1000 * 1000;
 
-    esp_http_client_config_t config = {
-        .url = HTTP_URL,
-        .event_handler = _http_event_handler,
-    };
+    gettimeofday(&tv, NULL);
+    localtime_r(&tv.tv_sec, &timeinfo);
+
+    // Poll every second until SNTP sets the clock
+    if (timeinfo.tm_year >= (2016 - 1900)) {
+        int32_t minute = meter_time_minute(&timeinfo);
+
+        // Buffered pulses go in before the stores move past their hours
+        pulse_backfill();
+
+        // An early wake or a clock stepped back waits for the same boundary again
+        if (minute > pulse_minute) {
+            mod_watt_hour_meter_lock();
+            int night = 0;
+            for (int i = 0; i < pulse_channel_count; ++i) {
+                int64_t second = (int64_t)minute * 60 + timeinfo.tm_sec;
+                night |= meter_channel_advance(&pulse_channels[i].meter, esp_timer_get_time(), second) << i;
+            }
+            mod_watt_hour_meter_unlock();
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t err = esp_http_client_perform(client);
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "HTTPS Status = %d, content_length = %d",
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
-    } else {
-        ESP_LOGE(TAG, "Error perform http request %d", err);
+            for (int i = 0; i < pulse_channel_count; ++i) {
+                if ((night & (1 << i)) == 0)
+                    continue;
+                int alarm = 0;
+                uint32_t base = mod_watt_hour_meter_base(i, &alarm);
+                if (alarm)
+                    ESP_LOGW(TAG, "%s continuous load, base %u W", pulse_channels[i].name, base / 1000);
+                else
+                    ESP_LOGI(TAG, "%s base load %u W", pulse_channels[i].name, base / 1000);
+            }
+
+            mod_upload_boundary(pulse_minute, minute);
+            if (CONFIG_PULSE_STRESS_RATE)
+                mod_journal_compact();
+            if (pulse_minute >= 0 && minute / 1440 != pulse_minute / 1440) {
+                for (int i = 0; i < pulse_channel_count; ++i) {
+                    mod_watt_hour_meter_lock();
+                    uint32_t total = meter_store_day(PULSE_STORE[i], pulse_minute / 1440);
+                    mod_watt_hour_meter_unlock();
+                    ESP_LOGI(TAG, "%s closed day with %u pulses", pulse_channels[i].name, total);
+                }
+            }
+            pulse_minute = minute;
+        }
+
+        timeout = (60 - timeinfo.tm_sec) * 1000000LL - tv.tv_usec;
+        if (timeout < 1000)
+            timeout = 1000;
     }
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
 
-    // Time
+    esp_timer_start_once(pulse_timer, timeout);
+}
+
+static void pulse_timer_callback(void *parameter)
+{
+    // The esp_timer task must not block, so the boundary work runs in pulse_task
+    pulse_tick = 1;
+    xTaskNotifyGive(pulse_task_handle);
+}
+
+// Counts into the buckets and the journal, pulse_time is 0 for external sources
+static void pulse_add(int channel, int64_t pulse_time, int64_t second, uint32_t count, const uint32_t *reading)
+{
+    mod_watt_hour_meter_lock();
+    int32_t minute = meter_channel_count(&pulse_channels[channel].meter, pulse_time, second, count, mod_tariff_price(second / 60));
+    portENTER_CRITICAL();
+    mod_journal_add(channel, minute / 60, count, 0);
+    if (reading)
+        mod_journal_reading(channel, *reading);
+    portEXIT_CRITICAL();
+    mod_watt_hour_meter_unlock();
+}
+
+static int pulse_count(int channel, int64_t pulse_time)
+{
+    meter_event_step_t step;
+    int stepped;
+
+    mod_watt_hour_meter_lock();
+    stepped = meter_channel_pulse(&pulse_channels[channel].meter, pulse_time, &step);
+    mod_watt_hour_meter_unlock();
+
     time_t now = 0;
     struct tm timeinfo = { 0 };
 
+    // The pulse may have waited in the ring, so step back to when it happened
     time(&now);
+    if (stepped) {
+        time_t when = now - (esp_timer_get_time() - step.time) / (1000 * 1000);
+        localtime_r(&when, &timeinfo);
+        ESP_LOGI(TAG, "%s load %+d W at %02d:%02d:%02d", pulse_channels[channel].name, step.delta / 1000, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+        mod_mqtt_event(channel, when, step.delta);
+    }
+    now -= (esp_timer_get_time() - pulse_time) / (1000 * 1000);
     localtime_r(&now, &timeinfo);
-    PULSE_TIMEINFO = timeinfo;
 
-    free(HTTP_URL);
-    
-    vTaskDelete(NULL);
-}
+    if (timeinfo.tm_year < (2016 - 1900)) {
+        pulse_backlog_add(channel, pulse_time);
+        return 0;
+    }
+    pulse_backfill();
 
-static void pulse_log(void *parameter)
-{
-    mod_mqtt_publish();
+    int32_t minute = meter_time_minute(&timeinfo);
+    pulse_add(channel, pulse_time, (int64_t)minute * 60 + timeinfo.tm_sec, 1, NULL);
 
 #if WATT_DEBUG
-    ESP_LOGI(TAG, "pulse : %d (%d.%d.%d %d:%d:%d)", PULSE_PER_HOUR[timeinfo.tm_mday][timeinfo.tm_hour], timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+    ESP_LOGI(TAG, "pulse %d : %u (%d.%d.%d %d:%d:%d)", channel, meter_store_minute(PULSE_STORE[channel], minute), timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
 #endif
-    vTaskDelete(NULL);
+
+    return 1;
 }
 
-static void pulse(void *parameter)
+static void pulse_publish(void *parameter)
 {
-    static int last_hour = -1;
-    static int64_t last_time = 0;
-    int64_t pulse_time = esp_timer_get_time();
-    int64_t delta_time = pulse_time - last_time;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        mod_mqtt_publish();
+    }
+}
 
-    if (delta_time < 100 * 1000)
-       return;
-    last_time = pulse_time;
+static void pulse_task(void *parameter)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-    PREVIOUS_TIME = CURRENT_TIME;
-    CURRENT_TIME = pulse_time;
+        int count = 0;
+        while (pulse_ring_tail != pulse_ring_head) {
+            volatile pulse_edge_t *edge = &pulse_ring[pulse_ring_tail % PULSE_RING_SIZE];
+            pulse_channel_t *channel = &pulse_channels[edge->channel];
+            int64_t now = esp_timer_get_time();
+            int64_t edge_time = now - (uint32_t)((uint32_t)now - edge->time);
+            int64_t pulse_time = 0;
 
-    time_t now = 0;
-    struct tm timeinfo = { 0 };
+            if (now - edge_time > PULSE_LATENCY_MAX)
+                PULSE_LATENCY_MAX = now - edge_time;
+            int counted = meter_channel_edge(&channel->meter, edge_time, edge->level, &pulse_time);
+            if (edge->level == PULSE_EDGE_MISSED)
+                PULSE_FLASH_BUSY += counted;
+            if (counted) {
+                if (CONFIG_PULSE_STRESS_RATE && edge->channel == 0)
+                    PULSE_STRESS_COUNTED++;
+                count += pulse_count(edge->channel, pulse_time);
 
-    time(&now);
-    localtime_r(&now, &timeinfo);
-
-    if (timeinfo.tm_year < (2016 - 1900))
-        return;
+                uint32_t cost = esp_timer_get_time() - now;
+                if (cost > PULSE_TASK_US_MAX)
+                    PULSE_TASK_US_MAX = cost;
+            }
+            pulse_ring_tail = pulse_ring_tail + 1;
+        }
 
-    PULSE_PER_HOUR[timeinfo.tm_mday][timeinfo.tm_hour]++;
-    xTaskCreate(&pulse_log, "pulse_log", 4096, NULL, 5, NULL);
+        // One publish per drained batch, however many pulses it held
+        if (count)
+            xTaskNotifyGive(pulse_publish_handle);
 
-    if (last_hour == timeinfo.tm_hour)
-        return;
-    if (last_hour != -1) {
-        xTaskCreate(&pulse_web, "pulse_web", 4096, NULL, 5, NULL);
-        if (last_hour == 23) {
-            for (int i = 0; i < 24; ++i)
-                PULSE_PER_HOUR[timeinfo.tm_mday][i] = 0;
-            PULSE_PER_HOUR[timeinfo.tm_mday][timeinfo.tm_hour]++;
+        // Boundaries close after the pulses before them are counted
+        if (pulse_tick) {
+            pulse_tick = 0;
+            pulse_boundary();
         }
     }
-    last_hour = timeinfo.tm_hour;
+}
+
+static inline __attribute__((always_inline)) uint32_t pulse_ccount(void)
+{
+    uint32_t ccount;
+
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+}
+
+// Called from the ISR, or with interrupts masked
+static int IRAM_ATTR pulse_push(int channel, uint32_t time, int level)
+{
+    uint32_t head = pulse_ring_head;
+    uint32_t used = head - pulse_ring_tail;
+
+    if (used >= PULSE_RING_SIZE) {
+        PULSE_OVERFLOW++;
+        return 0;
+    }
+    if (used + 1 > PULSE_RING_PEAK)
+        PULSE_RING_PEAK = used + 1;
+    pulse_ring[head % PULSE_RING_SIZE].time = time;
+    pulse_ring[head % PULSE_RING_SIZE].channel = channel;
+    pulse_ring[head % PULSE_RING_SIZE].level = level;
+    pulse_ring_head = head + 1;
+
+    return 1;
+}
+
+static void IRAM_ATTR pulse(void *parameter)
+{
+    uint32_t ccount = pulse_ccount();
+    uint32_t pulse_time = (uint32_t)esp_timer_get_time();
+    int channel = (int)(intptr_t)parameter;
+    uint32_t level = (GPIO.in >> pulse_channels[channel].gpio_num) & 1;
+    int masked = pulse_flash_busy || pulse_time - pulse_flash_end < PULSE_FLASH_SLACK;
+    int pushed = 0;
+
+    if (level == pulse_channels[channel].level && masked)
+        pushed |= pulse_push(channel, pulse_time, PULSE_EDGE_MISSED);
+    if (level != pulse_channels[channel].level || level == 0 || !masked)
+        pushed |= pulse_push(channel, pulse_time, level);
+    pulse_channels[channel].level = level;
+
+    if (pushed) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(pulse_task_handle, &woken);
+        if (woken == pdTRUE)
+            portYIELD_FROM_ISR();
+    }
+
+    ccount = pulse_ccount() - ccount;
+    if (ccount > PULSE_ISR_CYCLES_MAX)
+        PULSE_ISR_CYCLES_MAX = ccount;
+}
+
+#if CONFIG_PULSE_STRESS_RATE
+// Hardware timer interrupt every half period, low then high like a meter output
+static void IRAM_ATTR pulse_stress(void *parameter)
+{
+    uint32_t mask = 1 << pulse_channels[0].gpio_num;
+
+    if (GPIO.out & mask) {
+        GPIO.out_w1tc = mask;
+        PULSE_STRESS_GENERATED++;
+    }
+    else {
+        GPIO.out_w1ts = mask;
+    }
+}
+#endif
+
+static void pulse_channel_parse(const char *config)
+{
+    /* GPIO[:IMP_KWH[:WIDTH_MIN[:WIDTH_MAX[:LOCKOUT_MAX]]]] per channel, separated by ';',
+       or the name of a source feeding the channel in Wh */
+    while (*config != 0 && pulse_channel_count < WATT_HOUR_METER_CHANNELS) {
+        long values[5] = { -1, CONFIG_IMP_KWH, CONFIG_PULSE_WIDTH_MIN, CONFIG_PULSE_WIDTH_MAX, CONFIG_PULSE_LOCKOUT_MAX };
+        const char *source = NULL;
+        char *end = (char *)config;
 
-    if (PULSE_TIMEINFO.tm_year < (2016 - 1900))
-        PULSE_TIMEINFO = timeinfo;
+        for (int i = 0; i < sizeof(pulse_sources) / sizeof(pulse_sources[0]); ++i) {
+            int length = strlen(pulse_sources[i]);
+            if (strncmp(config, pulse_sources[i], length) == 0 && (config[length] == 0 || config[length] == ';')) {
+                source = pulse_sources[i];
+                values[0] = PULSE_EXTERNAL;
+                values[1] = 1000;
+            }
+        }
+        for (int i = 0; i < 5 && values[0] != PULSE_EXTERNAL; ++i) {
+            long value = strtol(config, &end, 10);
+            if (end == config)
+                break;
+            values[i] = value;
+            config = end;
+            if (*config != ':')
+                break;
+            config++;
+        }
+        while (*config != 0 && *config != ';')
+            config++;
+        if (*config == ';')
+            config++;
+
+        // GPIO16 has no edge interrupt
+        if (values[0] < 0 || (values[0] >= GPIO_NUM_16 && values[0] != PULSE_EXTERNAL) || values[1] <= 0)
+            continue;
+
+        pulse_channel_t *channel = &pulse_channels[pulse_channel_count++];
+        channel->gpio_num = (gpio_num_t)values[0];
+        channel->source = source;
+        meter_channel_init(&channel->meter, values[1], values[2], values[3], values[4], CONFIG_DEMAND_INTERVAL);
+    }
 }
 
-void mod_watt_hour_meter(gpio_num_t gpio_num)
+void mod_watt_hour_meter(void)
 {
     // Get MAC
     uint8_t mac[6] = { 0 };
@@ -235,14 +510,295 @@ void mod_watt_hour_meter(gpio_num_t gpio_num)
     }
     AREA_NAME[sizeof(AREA_NAME) - 1] = 0;
 
-    gpio_set_direction(gpio_num, GPIO_MODE_INPUT);
-    gpio_set_intr_type(gpio_num, GPIO_INTR_NEGEDGE);
-    gpio_set_pull_mode(gpio_num, GPIO_PULLUP_ONLY);
+    // Set Channels
+    pulse_channel_parse(CONFIG_METER_CHANNELS);
+    for (int i = 0; i < pulse_channel_count; ++i) {
+        pulse_channel_t *channel = &pulse_channels[i];
+        if (pulse_channel_count == 1)
+            snprintf((char*)channel->name, sizeof(channel->name), "%s", AREA_NAME);
+        else
+            snprintf((char*)channel->name, sizeof(channel->name), "%.12s-%d", AREA_NAME, i + 1);
+    }
+
+    // Restore the stores before the first pulse can arrive
+    pulse_mutex = xSemaphoreCreateMutex();
+    for (int i = 0; i < pulse_channel_count; ++i) {
+        meter_store_t *store = calloc(1, sizeof(meter_store_t));
+        meter_event_t *event = calloc(1, sizeof(meter_event_t));
+        meter_load_t *load = calloc(1, sizeof(meter_load_t));
+        if (store == NULL || event == NULL || load == NULL) {
+            // Reported on the page and over MQTT, the channels after it stay off
+            PULSE_CHANNELS_FAILED = pulse_channel_count - i;
+            ESP_LOGE(TAG, "Error allocating channel %d, %u channels off (%u B free)", i, PULSE_CHANNELS_FAILED, esp_get_free_heap_size());
+            free(store);
+            free(event);
+            free(load);
+            pulse_channel_count = i;
+            break;
+        }
+        meter_channel_attach(&pulse_channels[i].meter, store, event, load, CONFIG_EVENT_THRESHOLD * 1000);
+        PULSE_STORE[i] = store;
+    }
+    mod_tariff();
+    mod_journal();
+
+    xTaskCreate(&pulse_task, "pulse_task", 4096, NULL, 6, &pulse_task_handle);
+    xTaskCreate(&pulse_publish, "pulse_publish", 4096, NULL, 5, &pulse_publish_handle);
+    esp_timer_create_args_t timer_args = {
+        .callback = pulse_timer_callback,
+        .name = "pulse_timer",
+    };
+    esp_timer_create(&timer_args, &pulse_timer);
+    esp_timer_start_once(pulse_timer, 1000 * 1000);
     gpio_install_isr_service(0);
-    gpio_isr_handler_add(gpio_num, pulse, NULL);
+    for (int i = 0; i < pulse_channel_count; ++i) {
+        gpio_num_t gpio_num = pulse_channels[i].gpio_num;
+        if (gpio_num == PULSE_EXTERNAL)
+            continue;
+        gpio_set_direction(gpio_num, GPIO_MODE_INPUT);
+        gpio_set_intr_type(gpio_num, GPIO_INTR_ANYEDGE);
+        gpio_set_pull_mode(gpio_num, GPIO_PULLUP_ONLY);
+        pulse_channels[i].level = gpio_get_level(gpio_num);
+        gpio_isr_handler_add(gpio_num, pulse, (void *)(intptr_t)i);
+    }
+#if CONFIG_PULSE_STRESS_RATE
+    if (pulse_channel_count > 0 && pulse_channels[0].gpio_num != PULSE_EXTERNAL) {
+        // The input register follows the driven pad, so the interrupt still fires
+        GPIO.out_w1ts = 1 << pulse_channels[0].gpio_num;
+        gpio_set_direction(pulse_channels[0].gpio_num, GPIO_MODE_OUTPUT);
+        hw_timer_init(pulse_stress, NULL);
+        hw_timer_alarm_us(500 * 1000 / CONFIG_PULSE_STRESS_RATE, true);
+        ESP_LOGW(TAG, "stress %d pulses/s on GPIO%d", CONFIG_PULSE_STRESS_RATE, pulse_channels[0].gpio_num);
+    }
+#endif
 }
 
-void mod_watt_hour_meter_http_handler(httpd_req_t *req)
+void mod_watt_hour_meter_flash_begin(void)
+{
+    portENTER_CRITICAL();
+    pulse_flash_busy++;
+    portEXIT_CRITICAL();
+}
+
+void mod_watt_hour_meter_flash_end(void)
+{
+    portENTER_CRITICAL();
+    pulse_flash_busy--;
+    pulse_flash_end = (uint32_t)esp_timer_get_time();
+    portEXIT_CRITICAL();
+}
+
+int mod_watt_hour_meter_channels(void)
+{
+    return pulse_channel_count;
+}
+
+const char *mod_watt_hour_meter_name(int channel)
+{
+    return (char*)pulse_channels[channel].name;
+}
+
+void mod_watt_hour_meter_lock(void)
+{
+    xSemaphoreTake(pulse_mutex, portMAX_DELAY);
+}
+
+void mod_watt_hour_meter_unlock(void)
+{
+    xSemaphoreGive(pulse_mutex);
+}
+
+int32_t mod_watt_hour_meter_add(int channel, int32_t minute, uint32_t count, int tagged)
+{
+    mod_watt_hour_meter_lock();
+    minute = meter_store_add(PULSE_STORE[channel], minute, count, mod_tariff_price(minute));
+    if (tagged)
+        meter_store_tag(PULSE_STORE[channel], minute);
+    portENTER_CRITICAL();
+    mod_journal_add(channel, minute / 60, count, tagged);
+    portEXIT_CRITICAL();
+    mod_watt_hour_meter_unlock();
+
+    return minute;
+}
+
+int mod_watt_hour_meter_minutes(int channel, int32_t minute, int count, uint16_t *counts)
+{
+    const meter_store_t *store = PULSE_STORE[channel];
+    int found;
+
+    mod_watt_hour_meter_lock();
+    found = store->minute >= 0 && store->minute - minute < METER_STORE_MINUTES;
+    for (int i = 0; i < count; ++i) {
+        counts[i] = meter_store_minute(store, minute + i);
+    }
+    mod_watt_hour_meter_unlock();
+
+    return found;
+}
+
+int mod_watt_hour_meter_hours(int channel, int32_t day, uint32_t hours[24])
+{
+    int found;
+
+    mod_watt_hour_meter_lock();
+    found = meter_store_hours(PULSE_STORE[channel], day, hours);
+    mod_watt_hour_meter_unlock();
+
+    return found;
+}
+
+uint32_t mod_watt_hour_meter_day(int channel, int32_t day)
+{
+    uint32_t total;
+
+    mod_watt_hour_meter_lock();
+    total = meter_store_day(PULSE_STORE[channel], day);
+    mod_watt_hour_meter_unlock();
+
+    return total;
+}
+
+uint32_t mod_watt_hour_meter_tagged(int channel, int32_t day)
+{
+    uint32_t tagged;
+
+    mod_watt_hour_meter_lock();
+    tagged = meter_store_tagged(PULSE_STORE[channel], day);
+    mod_watt_hour_meter_unlock();
+
+    return tagged;
+}
+
+void mod_watt_hour_meter_totals(int channel, meter_store_totals_t *totals)
+{
+    mod_watt_hour_meter_lock();
+    meter_store_totals(PULSE_STORE[channel], totals);
+    mod_watt_hour_meter_unlock();
+}
+
+uint64_t mod_watt_hour_meter_wh(int channel, uint64_t pulses)
+{
+    return pulses * 1000 / pulse_channels[channel].meter.power.imp_kwh;
+}
+
+uint32_t mod_watt_hour_meter_imp(int channel)
+{
+    return pulse_channels[channel].meter.power.imp_kwh;
+}
+
+uint32_t mod_watt_hour_meter_cost(int channel, uint64_t cost)
+{
+    return cost / pulse_channels[channel].meter.power.imp_kwh;
+}
+
+void mod_watt_hour_meter_forecast(int channel, uint32_t *day, uint32_t *month)
+{
+    time_t now = 0;
+    struct tm timeinfo = { 0 };
+    meter_store_totals_t totals;
+    meter_forecast_t forecast;
+
+    time(&now);
+    localtime_r(&now, &timeinfo);
+
+    mod_watt_hour_meter_lock();
+    meter_store_totals(PULSE_STORE[channel], &totals);
+    forecast = pulse_channels[channel].meter.forecast;
+    mod_watt_hour_meter_unlock();
+
+    // Whole days of the month after today
+    int year = timeinfo.tm_year + 1900;
+    int32_t today = meter_time_days(year, timeinfo.tm_mon + 1, timeinfo.tm_mday);
+    int32_t next = timeinfo.tm_mon == 11 ? meter_time_days(year + 1, 1, 1) : meter_time_days(year, timeinfo.tm_mon + 2, 1);
+
+    *day = mod_watt_hour_meter_wh(channel, meter_forecast_day(&forecast, totals.day, timeinfo.tm_min));
+    *month = mod_watt_hour_meter_wh(channel, meter_forecast_month(&forecast, totals.month, totals.day, timeinfo.tm_min, next - today - 1));
+}
+
+uint32_t mod_watt_hour_meter_base(int channel, int *alarm)
+{
+    uint32_t base;
+
+    mod_watt_hour_meter_lock();
+    base = pulse_channels[channel].meter.load->base;
+    mod_watt_hour_meter_unlock();
+
+#if CONFIG_BASE_LOAD_ALARM
+    *alarm = base >= CONFIG_BASE_LOAD_ALARM * 1000;
+#else
+    *alarm = 0;
+#endif
+    return base;
+}
+
+int mod_watt_hour_meter_external(const char *source)
+{
+    for (int i = 0; i < pulse_channel_count; ++i) {
+        if (pulse_channels[i].source && strcmp(pulse_channels[i].source, source) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int pulse_external(int channel, uint32_t count, int32_t power, const uint32_t *reading)
+{
+    time_t now = 0;
+    struct tm timeinfo = { 0 };
+
+    pulse_channels[channel].external_power = power;
+
+    // The source keeps counting until the clock is set
+    time(&now);
+    localtime_r(&now, &timeinfo);
+    if (timeinfo.tm_year < (2016 - 1900))
+        return -1;
+    if (count == 0)
+        return 0;
+
+    int32_t minute = meter_time_minute(&timeinfo);
+    pulse_add(channel, 0, (int64_t)minute * 60 + timeinfo.tm_sec, count, reading);
+    xTaskNotifyGive(pulse_publish_handle);
+
+    return 0;
+}
+
+int mod_watt_hour_meter_energy(int channel, uint32_t count, int32_t power)
+{
+    return pulse_external(channel, count, power, NULL);
+}
+
+int mod_watt_hour_meter_reading(int channel, uint32_t reading, int32_t power)
+{
+    uint32_t booked;
+
+    // The first reading ever, or a counter that went backwards, is only the baseline
+    if (mod_journal_booked(channel, &booked) == 0 || reading < booked) {
+        pulse_channels[channel].external_power = power;
+        portENTER_CRITICAL();
+        mod_journal_reading(channel, reading);
+        portEXIT_CRITICAL();
+        return 0;
+    }
+
+    return pulse_external(channel, reading - booked, power, &reading);
+}
+
+int32_t mod_watt_hour_meter_power(int channel)
+{
+    meter_power_t power;
+
+    if (pulse_channels[channel].gpio_num == PULSE_EXTERNAL)
+        return pulse_channels[channel].external_power;
+
+    mod_watt_hour_meter_lock();
+    power = pulse_channels[channel].meter.power;
+    mod_watt_hour_meter_unlock();
+
+    return meter_power_read(&power, esp_timer_get_time());
+}
+
+int32_t mod_watt_hour_meter_demand(int channel, meter_demand_t *demand)
 {
     time_t now = 0;
     struct tm timeinfo = { 0 };
@@ -250,10 +806,71 @@ void mod_watt_hour_meter_http_handler(httpd_req_t *req)
     time(&now);
     localtime_r(&now, &timeinfo);
 
+    int32_t power = mod_watt_hour_meter_power(channel);
+    mod_watt_hour_meter_lock();
+    *demand = pulse_channels[channel].meter.demand;
+    mod_watt_hour_meter_unlock();
+
+    return meter_demand_projected(demand, (int64_t)meter_time_minute(&timeinfo) * 60 + timeinfo.tm_sec, power);
+}
+
+static void mod_watt_hour_meter_http_channel(httpd_req_t *req, int channel, const struct tm *timeinfo)
+{
+    pulse_channel_t *pulse_channel = &pulse_channels[channel];
+    int32_t today = meter_time_days(timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday);
+    meter_store_totals_t totals;
+    uint32_t hours[24];
+
+    // Name
+    int32_t power = mod_watt_hour_meter_power(channel);
+    mod_webserver_printf(req, "<h2>%s - %d.%02dW</h2>", pulse_channel->name, power / 1000, power % 1000 / 10);
+
+    // Totals
+    mod_watt_hour_meter_totals(channel, &totals);
+    uint32_t day_wh = mod_watt_hour_meter_wh(channel, totals.day);
+    uint32_t month_wh = mod_watt_hour_meter_wh(channel, totals.month);
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Hour : %u Wh<br>", (uint32_t)mod_watt_hour_meter_wh(channel, totals.hour));
+    mod_webserver_printf(req, "Today : %u.%02u kWh<br>", day_wh / 1000, day_wh % 1000 / 10);
+    mod_webserver_printf(req, "Month : %u.%02u kWh<br>", month_wh / 1000, month_wh % 1000 / 10);
+    mod_webserver_printf(req, "Lifetime : %llu Wh<br>", (unsigned long long)mod_watt_hour_meter_wh(channel, totals.lifetime));
+    mod_webserver_printf(req, "</p>");
+
+    // Forecast
+    uint32_t forecast_day_wh, forecast_month_wh;
+    mod_watt_hour_meter_forecast(channel, &forecast_day_wh, &forecast_month_wh);
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Forecast Today : %u.%02u kWh<br>", forecast_day_wh / 1000, forecast_day_wh % 1000 / 10);
+    mod_webserver_printf(req, "Forecast Month : %u.%02u kWh<br>", forecast_month_wh / 1000, forecast_month_wh % 1000 / 10);
+    mod_webserver_printf(req, "</p>");
+
+    // Cost, in 1/1000 of the currency unit
+    uint32_t day_cost = mod_watt_hour_meter_cost(channel, totals.day_cost);
+    uint32_t month_cost = mod_watt_hour_meter_cost(channel, totals.month_cost);
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Cost Today : %u.%02u<br>", day_cost / 1000, day_cost % 1000 / 10);
+    mod_webserver_printf(req, "Cost Month : %u.%02u<br>", month_cost / 1000, month_cost % 1000 / 10);
+    mod_webserver_printf(req, "</p>");
+
+    // Demand
+    meter_demand_t demand;
+    int32_t projected = mod_watt_hour_meter_demand(channel, &demand);
+    int32_t day_peak = meter_demand_power(&demand, demand.day_peak);
+    int32_t month_peak = meter_demand_power(&demand, demand.month_peak);
+    int year, month, mday;
+    meter_time_civil(demand.month_peak_start / 86400, &year, &month, &mday);
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Demand : %d W projected (%u s)<br>", projected / 1000, demand.interval);
+    mod_webserver_printf(req, "Day Peak : %d W at %02d:%02d<br>", day_peak / 1000,
+                              (int)(demand.day_peak_start % 86400 / 3600), (int)(demand.day_peak_start % 3600 / 60));
+    mod_webserver_printf(req, "Month Peak : %d W at %d/%d %02d:%02d<br>", month_peak / 1000, month, mday,
+                              (int)(demand.month_peak_start % 86400 / 3600), (int)(demand.month_peak_start % 3600 / 60));
+    mod_webserver_printf(req, "</p>");
+
     // Chart
-    mod_webserver_printf(req, "%s", "<canvas id=\"meter\" height=\"50%\"></canvas>");
+    mod_webserver_printf(req, "<canvas id=\"meter%d\" height=\"50%%\"></canvas>", channel);
     mod_webserver_printf(req, "<script>");
-    mod_webserver_printf(req, "var ctx = document.getElementById('meter');");
+    mod_webserver_printf(req, "var ctx = document.getElementById('meter%d');", channel);
     mod_webserver_printf(req, "var myChart = new Chart(ctx, {");
     mod_webserver_printf(req,   "type: 'line',");
     mod_webserver_printf(req,   "data: {");
@@ -275,18 +892,19 @@ void mod_watt_hour_meter_http_handler(httpd_req_t *req)
     mod_webserver_printf(req,     "datasets: [{");
     mod_webserver_printf(req,       "label: 'pulse',");
     mod_webserver_printf(req,       "data: [");
+    mod_watt_hour_meter_hours(channel, today, hours);
     for (int hour = 0; hour < 24; hour += 6) {
-        mod_webserver_printf(req, "%s%d"
-                                  "%s%d"
-                                  "%s%d"
-                                  "%s%d"
-                                  "%s%d"
-                                  "%s%d", (hour + 0) ? "," : "", PULSE_PER_HOUR[timeinfo.tm_mday][hour + 0],
-                                          (hour + 1) ? "," : "", PULSE_PER_HOUR[timeinfo.tm_mday][hour + 1],
-                                          (hour + 2) ? "," : "", PULSE_PER_HOUR[timeinfo.tm_mday][hour + 2],
-                                          (hour + 3) ? "," : "", PULSE_PER_HOUR[timeinfo.tm_mday][hour + 3],
-                                          (hour + 4) ? "," : "", PULSE_PER_HOUR[timeinfo.tm_mday][hour + 4],
-                                          (hour + 5) ? "," : "", PULSE_PER_HOUR[timeinfo.tm_mday][hour + 5]);
+        mod_webserver_printf(req, "%s%u"
+                                  "%s%u"
+                                  "%s%u"
+                                  "%s%u"
+                                  "%s%u"
+                                  "%s%u", (hour + 0) ? "," : "", hours[hour + 0],
+                                          (hour + 1) ? "," : "", hours[hour + 1],
+                                          (hour + 2) ? "," : "", hours[hour + 2],
+                                          (hour + 3) ? "," : "", hours[hour + 3],
+                                          (hour + 4) ? "," : "", hours[hour + 4],
+                                          (hour + 5) ? "," : "", hours[hour + 5]);
     }
     mod_webserver_printf(req,       "],");
     mod_webserver_printf(req,       "borderWidth: 1");
@@ -315,33 +933,130 @@ void mod_watt_hour_meter_http_handler(httpd_req_t *req)
     mod_webserver_printf(req, "<th>Total</th>");
     mod_webserver_printf(req, "<th>kWh</th>");
     mod_webserver_printf(req, "</tr>");
-    for (int day = 1; day < 32; ++day) {
-        int total = 0;
+    for (int32_t day = today; day > today - 31; --day) {
+        int year, month, mday;
+        uint32_t total = mod_watt_hour_meter_day(channel, day);
+        uint32_t wh = mod_watt_hour_meter_wh(channel, total);
+        uint32_t tagged = mod_watt_hour_meter_tagged(channel, day);
 
+        meter_time_civil(day, &year, &month, &mday);
+        mod_watt_hour_meter_hours(channel, day, hours);
         mod_webserver_printf(req, "<tr>");
-        mod_webserver_printf(req, "<th>%d</th>", day);
+        mod_webserver_printf(req, "<th>%d/%d</th>", month, mday);
         for (int hour = 0; hour < 24; hour += 6) {
-            mod_webserver_printf(req, "<th>%d</th>"
-                                      "<th>%d</th>"
-                                      "<th>%d</th>"
-                                      "<th>%d</th>"
-                                      "<th>%d</th>"
-                                      "<th>%d</th>", PULSE_PER_HOUR[day][hour + 0],
-                                                     PULSE_PER_HOUR[day][hour + 1],
-                                                     PULSE_PER_HOUR[day][hour + 2],
-                                                     PULSE_PER_HOUR[day][hour + 3],
-                                                     PULSE_PER_HOUR[day][hour + 4],
-                                                     PULSE_PER_HOUR[day][hour + 5]);
-            total += PULSE_PER_HOUR[day][hour + 0] +
-                     PULSE_PER_HOUR[day][hour + 1] +
-                     PULSE_PER_HOUR[day][hour + 2] +
-                     PULSE_PER_HOUR[day][hour + 3] +
-                     PULSE_PER_HOUR[day][hour + 4] +
-                     PULSE_PER_HOUR[day][hour + 5];
+            mod_webserver_printf(req, "<th>%u%s</th>"
+                                      "<th>%u%s</th>"
+                                      "<th>%u%s</th>"
+                                      "<th>%u%s</th>"
+                                      "<th>%u%s</th>"
+                                      "<th>%u%s</th>", hours[hour + 0], tagged & (1u << (hour + 0)) ? "*" : "",
+                                                       hours[hour + 1], tagged & (1u << (hour + 1)) ? "*" : "",
+                                                       hours[hour + 2], tagged & (1u << (hour + 2)) ? "*" : "",
+                                                       hours[hour + 3], tagged & (1u << (hour + 3)) ? "*" : "",
+                                                       hours[hour + 4], tagged & (1u << (hour + 4)) ? "*" : "",
+                                                       hours[hour + 5], tagged & (1u << (hour + 5)) ? "*" : "");
         }
-        mod_webserver_printf(req, "<th>%d</th>", total);
-        mod_webserver_printf(req, "<th>%.2f</th>", total / (float)CONFIG_IMP_KWH);
+        mod_webserver_printf(req, "<th>%u</th>", total);
+        mod_webserver_printf(req, "<th>%u.%02u</th>", wh / 1000, wh % 1000 / 10);
         mod_webserver_printf(req, "</tr>");
     }
     mod_webserver_printf(req, "</table>");
+    mod_webserver_printf(req, "<p>* back-filled from pulses counted before the clock was set</p>");
+
+    // Width
+    mod_webserver_printf(req, "%s", "<table style=\"width:100%\" border='1'>");
+    mod_webserver_printf(req, "<tr>");
+    mod_webserver_printf(req, "<th>Width</th>");
+    for (int i = 0; i < METER_FILTER_HISTOGRAM; ++i) {
+        mod_webserver_printf(req, "<th>%s%dus</th>", i == 0 ? "&lt;" : "", 256 << (i + (i == 0)));
+    }
+    mod_webserver_printf(req, "</tr>");
+    mod_webserver_printf(req, "<tr>");
+    mod_webserver_printf(req, "<th>Count</th>");
+    for (int i = 0; i < METER_FILTER_HISTOGRAM; ++i) {
+        mod_webserver_printf(req, "<th>%u</th>", pulse_channel->meter.filter.width_histogram[i]);
+    }
+    mod_webserver_printf(req, "</tr>");
+    mod_webserver_printf(req, "</table>");
+
+    // Events
+    meter_event_step_t steps[METER_EVENT_LOG];
+    uint32_t step_count = 0;
+    mod_watt_hour_meter_lock();
+    for (; step_count < METER_EVENT_LOG; ++step_count) {
+        const meter_event_step_t *step = meter_event_step(pulse_channel->meter.event, step_count);
+        if (step == NULL)
+            break;
+        steps[step_count] = *step;
+    }
+    mod_watt_hour_meter_unlock();
+
+    time_t now = 0;
+    time(&now);
+    int64_t esp_now = esp_timer_get_time();
+    mod_webserver_printf(req, "%s", "<table style=\"width:100%\" border='1'>");
+    mod_webserver_printf(req, "<tr><th>Event</th><th>Load</th></tr>");
+    for (uint32_t i = 0; i < step_count; ++i) {
+        time_t when = now - (esp_now - steps[i].time) / (1000 * 1000);
+        struct tm step_time = { 0 };
+        localtime_r(&when, &step_time);
+        mod_webserver_printf(req, "<tr><th>%d/%d %02d:%02d:%02d</th><th>%+d W</th></tr>", step_time.tm_mon + 1, step_time.tm_mday,
+                                  step_time.tm_hour, step_time.tm_min, step_time.tm_sec, steps[i].delta / 1000);
+    }
+    mod_webserver_printf(req, "</table>");
+
+    // Load duration, in hours at or above each power
+    uint32_t day_ms[METER_LOAD_BINS];
+    uint32_t month_ms[METER_LOAD_BINS];
+    int alarm = 0;
+    uint32_t base = mod_watt_hour_meter_base(channel, &alarm);
+    mod_watt_hour_meter_lock();
+    memcpy(day_ms, pulse_channel->meter.load->day_ms, sizeof(day_ms));
+    memcpy(month_ms, pulse_channel->meter.load->month_ms, sizeof(month_ms));
+    mod_watt_hour_meter_unlock();
+    mod_webserver_printf(req, "<p>Base Load : %u W%s</p>", base / 1000, alarm ? " (continuous load)" : "");
+    mod_webserver_printf(req, "%s", "<table style=\"width:100%\" border='1'>");
+    mod_webserver_printf(req, "<tr><th>Load</th><th>Today</th><th>Month</th></tr>");
+    for (int i = 0; i < METER_LOAD_BINS; ++i) {
+        if (month_ms[i] == 0)
+            continue;
+        mod_webserver_printf(req, "<tr><th>%u W</th><th>%u.%02u h</th><th>%u.%02u h</th></tr>", meter_load_power(i) / 1000,
+                                  day_ms[i] / 3600000, day_ms[i] / 36000 % 100, month_ms[i] / 3600000, month_ms[i] / 36000 % 100);
+    }
+    mod_webserver_printf(req, "</table>");
+
+    // Status
+    mod_webserver_printf(req, "<p>");
+    if (PULSE_CHANNELS_FAILED)
+        mod_webserver_printf(req, "<b>Channels Off : %u, out of memory</b><br>", PULSE_CHANNELS_FAILED);
+    mod_webserver_printf(req, "Rejected Edge : %u<br>", pulse_channel->meter.filter.rejected_edge);
+    mod_webserver_printf(req, "Rejected Width : %u<br>", pulse_channel->meter.filter.rejected_width);
+    mod_webserver_printf(req, "Rejected Lockout : %u<br>", pulse_channel->meter.filter.rejected_lockout);
+    mod_webserver_printf(req, "Rejected Missed : %u<br>", pulse_channel->meter.filter.rejected_missed);
+    mod_webserver_printf(req, "Lockout : %uus<br>", meter_filter_lockout(&pulse_channel->meter.filter));
+    mod_webserver_printf(req, "</p>");
+}
+
+void mod_watt_hour_meter_http_handler(httpd_req_t *req)
+{
+    time_t now = 0;
+    struct tm timeinfo = { 0 };
+
+    time(&now);
+    localtime_r(&now, &timeinfo);
+
+    for (int channel = 0; channel < pulse_channel_count; ++channel) {
+        mod_watt_hour_meter_http_channel(req, channel, &timeinfo);
+    }
+
+    // Status
+    mod_webserver_printf(req, "<p>");
+    mod_webserver_printf(req, "Pulse Overflow : %u (ring peak %u/%u)<br>", PULSE_OVERFLOW, PULSE_RING_PEAK, PULSE_RING_SIZE);
+    mod_webserver_printf(req, "Flash-busy pulses : %u<br>", PULSE_FLASH_BUSY);
+    mod_webserver_printf(req, "Pulse ISR : %u cycles, latency %u us, task %u us max<br>",
+                         PULSE_ISR_CYCLES_MAX, PULSE_LATENCY_MAX, PULSE_TASK_US_MAX);
+    if (CONFIG_PULSE_STRESS_RATE)
+        mod_webserver_printf(req, "Stress : %u generated, %u counted<br>", PULSE_STRESS_GENERATED, PULSE_STRESS_COUNTED);
+    mod_webserver_printf(req, "Back-filled : %u (%u dropped)<br>", PULSE_BACKFILLED, PULSE_BACKLOG_DROPPED);
+    mod_webserver_printf(req, "</p>");
 }
@@ -14,12 +14,48 @@
 
 #include <esp_http_server.h>
 
-extern unsigned short PULSE_PER_HOUR[32][24];
-extern unsigned char AREA_NAME[16];
-extern int64_t CURRENT_TIME;
-extern int64_t PREVIOUS_TIME;
+#include "meter_demand.h"
+#include "meter_store.h"
+
+#define WATT_HOUR_METER_CHANNELS 4
 
-void mod_watt_hour_meter(gpio_num_t gpio_num);
+extern meter_store_t *PULSE_STORE[WATT_HOUR_METER_CHANNELS];
+extern unsigned char AREA_NAME[16];
+extern uint32_t PULSE_OVERFLOW;
+extern uint32_t PULSE_FLASH_BUSY;
+extern uint32_t PULSE_RING_PEAK;
+extern uint32_t PULSE_ISR_CYCLES_MAX;
+extern uint32_t PULSE_LATENCY_MAX;
+extern uint32_t PULSE_TASK_US_MAX;
+extern uint32_t PULSE_BACKFILLED;
+extern uint32_t PULSE_BACKLOG_DROPPED;
+extern uint32_t PULSE_CHANNELS_FAILED;
+
+void mod_watt_hour_meter(void);
+int mod_watt_hour_meter_channels(void);
+void mod_watt_hour_meter_flash_begin(void);
+void mod_watt_hour_meter_flash_end(void);
+const char *mod_watt_hour_meter_name(int channel);
+void mod_watt_hour_meter_lock(void);
+void mod_watt_hour_meter_unlock(void);
+int32_t mod_watt_hour_meter_add(int channel, int32_t minute, uint32_t count, int tagged);
+int mod_watt_hour_meter_minutes(int channel, int32_t minute, int count, uint16_t *counts);
+int mod_watt_hour_meter_hours(int channel, int32_t day, uint32_t hours[24]);
+uint32_t mod_watt_hour_meter_day(int channel, int32_t day);
+uint32_t mod_watt_hour_meter_tagged(int channel, int32_t day);
+void mod_watt_hour_meter_totals(int channel, meter_store_totals_t *totals);
+uint64_t mod_watt_hour_meter_wh(int channel, uint64_t pulses);
+uint32_t mod_watt_hour_meter_imp(int channel);
+uint32_t mod_watt_hour_meter_cost(int channel, uint64_t cost);
+void mod_watt_hour_meter_forecast(int channel, uint32_t *day, uint32_t *month);
+uint32_t mod_watt_hour_meter_base(int channel, int *alarm);
+int mod_watt_hour_meter_external(const char *source);
+int mod_watt_hour_meter_energy(int channel, uint32_t count, int32_t power);
+/* Books the advance of a source's own counter, in pulses, since the reading
+   booked last, which the journal keeps across reboots */
+int mod_watt_hour_meter_reading(int channel, uint32_t reading, int32_t power);
+int32_t mod_watt_hour_meter_power(int channel);
+int32_t mod_watt_hour_meter_demand(int channel, meter_demand_t *demand);
 void mod_watt_hour_meter_http_handler(httpd_req_t *req);
 
 #endif
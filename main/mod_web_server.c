@@ -15,7 +15,13 @@
 #include <esp_spi_flash.h>
 
 #include "mod_bme680.h"
+#include "mod_ct.h"
+#include "mod_journal.h"
 #include "mod_log.h"
+#include "mod_modbus.h"
+#include "mod_tariff.h"
+#include "mod_https.h"
+#include "mod_upload.h"
 #include "mod_watt_hour_meter.h"
 #include "mod_web_server.h"
 #include "mod_wifi.h"
@@ -43,7 +49,10 @@ static esp_err_t home_get_handler(httpd_req_t *req)
     mod_webserver_printf(req, "<body>");
 
     // Area
-    mod_webserver_printf(req, "<h1>%s - %.2fW</h1>", AREA_NAME, (60.0 * 60.0 * 1000.0 * 1000.0 * 1000.0) / (CURRENT_TIME - PREVIOUS_TIME) / CONFIG_IMP_KWH);
+    int32_t power = 0;
+    for (int channel = 0; channel < mod_watt_hour_meter_channels(); ++channel)
+        power += mod_watt_hour_meter_power(channel);
+    mod_webserver_printf(req, "<h1>%s - %d.%02dW</h1>", AREA_NAME, power / 1000, power % 1000 / 10);
 
     // Date Time
     mod_webserver_printf(req, "<p>");
@@ -54,6 +63,12 @@ static esp_err_t home_get_handler(httpd_req_t *req)
 
     // Modules
     mod_watt_hour_meter_http_handler(req);
+    mod_modbus_http_handler(req);
+    mod_ct_http_handler(req);
+    mod_tariff_http_handler(req);
+    mod_journal_http_handler(req);
+    mod_upload_http_handler(req);
+    mod_https_http_handler(req);
     mod_bme680_http_handler(req);
     mod_log_http_handler(req);
     mod_wifi_http_handler(req);
@@ -86,6 +101,7 @@ static esp_err_t home_get_handler(httpd_req_t *req)
 
 static esp_err_t restart_get_handler(httpd_req_t *req)
 {
+    mod_journal_flush();
     esp_restart();
 
     return ESP_OK;
@@ -18,6 +18,7 @@
 #include <esp_log.h>
 #include <esp_system.h>
 
+#include "mod_journal.h"
 #include "mod_web_server.h"
 #include "mod_wifi.h"
 
@@ -47,6 +48,7 @@ static void mod_wifi_scan_result()
     uint16_t ap_count = 0;
     esp_wifi_scan_get_ap_num(&ap_count);	
     if (ap_count <= 0) {
+        mod_journal_flush();
         esp_restart();
         return;
     }
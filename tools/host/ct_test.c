@@ -0,0 +1,212 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meter_ct.h"
+
+/* meter_ct_burst on sample files, the text /ct of a device serves: a
+   "# RATE Hz, UA uA/count, noise NOISE/100" line and one ADC count per
+   line. The calibration comes from that line, the voltage, power factor
+   and minimum current from the Kconfig defaults or the options.
+
+   Without files the bursts are synthetic: a 50 Hz current with 10 % of
+   third harmonic on the 512 count bias, Gaussian noise of 1 count RMS,
+   rounded and clipped to 10 bits like the ADC, up to 10 A; around the
+   bias the default calibration clips above ~10.6 A RMS. Their header adds
+   "synthetic MA mA", the RMS current without noise, which the result has
+   to be within 1 % or 20 mA of, and 0 below the minimum current. -w DIR
+   writes them as files, which then run the same way.
+
+   The cost is the wall time of meter_ct_burst per burst on this host. */
+
+#define CT_RATE     1000
+#define CT_SAMPLES  200
+#define CT_UA_COUNT 29297
+#define CT_NOISE    100
+#define CT_RUNS     10000
+
+typedef struct ct_file {
+    int rate;
+    uint32_t ua_count;
+    uint32_t noise;
+    int32_t expected;
+    int count;
+    uint16_t samples[METER_CT_SAMPLES_MAX];
+} ct_file_t;
+
+static uint32_t ct_voltage = 230;
+static uint32_t ct_power_factor = 100;
+static uint32_t ct_current_min = 50;
+
+static double ct_gauss(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void ct_synthetic(ct_file_t *file, int32_t ma)
+{
+    // Fundamental and third harmonic of the RMS, in counts
+    double rms = ma * 1000.0 / CT_UA_COUNT;
+    double first = rms / sqrt(1 + 0.1 * 0.1) * sqrt(2);
+    double phase = 2 * M_PI * rand() / RAND_MAX;
+
+    file->rate = CT_RATE;
+    file->ua_count = CT_UA_COUNT;
+    file->noise = CT_NOISE;
+    file->expected = ma;
+    file->count = CT_SAMPLES;
+    for (int i = 0; i < CT_SAMPLES; ++i) {
+        double t = 2 * M_PI * 50 * i / CT_RATE + phase;
+        double value = 512 + first * (sin(t) + 0.1 * sin(3 * t)) + ct_gauss() * CT_NOISE / 100;
+        value = floor(value + 0.5);
+        file->samples[i] = value < 0 ? 0 : value > 1023 ? 1023 : value;
+    }
+}
+
+static int ct_read(ct_file_t *file, const char *name)
+{
+    FILE *in = fopen(name, "r");
+    char line[128];
+
+    if (in == NULL) {
+        perror(name);
+        return -1;
+    }
+    memset(file, 0, sizeof(ct_file_t));
+    file->rate = CT_RATE;
+    file->ua_count = CT_UA_COUNT;
+    file->noise = CT_NOISE;
+    file->expected = -1;
+    while (fgets(line, sizeof(line), in)) {
+        if (line[0] == '#') {
+            sscanf(line, "# %d Hz, %u uA/count, noise %u/100, synthetic %d mA", &file->rate, &file->ua_count, &file->noise, &file->expected);
+            continue;
+        }
+        if (file->count >= METER_CT_SAMPLES_MAX)
+            break;
+        file->samples[file->count++] = atoi(line);
+    }
+    fclose(in);
+
+    return file->count > 0 ? 0 : -1;
+}
+
+static int ct_write(const ct_file_t *file, const char *name)
+{
+    FILE *out = fopen(name, "w");
+
+    if (out == NULL) {
+        perror(name);
+        return -1;
+    }
+    fprintf(out, "# %d Hz, %u uA/count, noise %u/100, synthetic %d mA\n", file->rate, file->ua_count, file->noise, file->expected);
+    for (int i = 0; i < file->count; ++i)
+        fprintf(out, "%u\n", file->samples[i]);
+    fclose(out);
+
+    return 0;
+}
+
+static int ct_run(const ct_file_t *file, const char *name)
+{
+    meter_ct_t ct, raw;
+    meter_ct_burst_t burst, unfloored;
+    struct timespec start, end;
+
+    meter_ct_init(&ct, file->ua_count, ct_voltage, ct_power_factor, file->noise, ct_current_min);
+    meter_ct_init(&raw, file->ua_count, ct_voltage, ct_power_factor, 0, 0);
+    meter_ct_burst(&raw, file->samples, file->count, &unfloored);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < CT_RUNS; ++i)
+        meter_ct_burst(&ct, file->samples, file->count, &burst);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / CT_RUNS;
+
+    // Within 1 % or 20 mA of a synthetic current, nothing below the minimum
+    int failed = 0;
+    if (file->expected >= 0) {
+        int32_t error = (int32_t)burst.current - file->expected;
+        int32_t tolerance = file->expected / 100 > 20 ? file->expected / 100 : 20;
+        if (file->expected < (int32_t)ct_current_min)
+            failed = (int32_t)burst.current > file->expected + tolerance;
+        else
+            failed = error > tolerance || error < -tolerance;
+    }
+
+    printf("%-30s %6d %7u.%02u %6u.%02u %6u.%02u %7u %7u %9d %8.0f  %s\n", name, file->count,
+           burst.offset >> 8, (burst.offset & 0xFF) * 100 / 256, burst.rms >> 8, (burst.rms & 0xFF) * 100 / 256,
+           burst.signal >> 8, (burst.signal & 0xFF) * 100 / 256, unfloored.current, burst.current, burst.power / 1000, ns,
+           file->expected < 0 ? "" : failed ? "FAIL" : "ok");
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int32_t currents[] = { 0, 20, 50, 100, 500, 1000, 5000, 10000 };
+    const char *write = NULL;
+    ct_file_t file;
+    int errors = 0;
+    int files = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            write = argv[++i];
+        else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc)
+            ct_voltage = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            ct_power_factor = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            ct_current_min = atoi(argv[++i]);
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-w dir] [-v volt] [-p power factor %%] [-m min mA] [samples.txt ...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-30s %6s %10s %9s %9s %7s %7s %9s %8s\n", "burst", "count", "offset", "rms", "signal", "raw mA", "mA", "W", "ns");
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            i++;
+            continue;
+        }
+        files++;
+        if (ct_read(&file, argv[i]) != 0) {
+            errors++;
+            continue;
+        }
+        errors += ct_run(&file, argv[i]);
+    }
+    if (files)
+        return errors != 0;
+
+    srand(1);
+    for (int i = 0; i < sizeof(currents) / sizeof(currents[0]); ++i) {
+        char name[256];
+        ct_synthetic(&file, currents[i]);
+        snprintf(name, sizeof(name), "synthetic %d mA", currents[i]);
+        if (write) {
+            snprintf(name, sizeof(name), "%s/synthetic_%05d.txt", write, currents[i]);
+            if (ct_write(&file, name) != 0)
+                return 2;
+        }
+        errors += ct_run(&file, name);
+    }
+
+    return errors != 0;
+}
@@ -0,0 +1,23 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef _ESP_SYSTEM_H_
+#define _ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* HOST_HEAP less the bytes in use, counted by the malloc of host.c */
+uint32_t esp_get_free_heap_size(void);
+
+/* Allocations since the start, for checks that a path allocates nothing */
+extern uint32_t HOST_MALLOCS;
+
+#endif
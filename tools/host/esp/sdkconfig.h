@@ -0,0 +1,15 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* Kconfig defaults of the host builds, overridden with -D. As the
+   Kconfig, there is no fingerprint with UPLOAD_TLS_CA. */
+
+#if !defined(CONFIG_UPLOAD_TLS_FINGERPRINT) && !defined(CONFIG_UPLOAD_TLS_CA)
+#define CONFIG_UPLOAD_TLS_FINGERPRINT ""
+#endif
@@ -0,0 +1,98 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mod_web_server.h"
+
+/* SDK functions for the mod_*.c built on the host. malloc and friends
+   are replaced for the whole process, shared libraries included, so the
+   free heap follows every allocation of mbedtls as it does on the device. */
+
+#define HOST_HEAP (64u * 1024 * 1024)
+
+uint32_t HOST_MALLOCS;
+static size_t host_used;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+void *malloc(size_t size)
+{
+    void *pointer = __libc_malloc(size);
+
+    if (pointer) {
+        host_used += malloc_usable_size(pointer);
+        HOST_MALLOCS++;
+    }
+    return pointer;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *pointer = __libc_calloc(count, size);
+
+    if (pointer) {
+        host_used += malloc_usable_size(pointer);
+        HOST_MALLOCS++;
+    }
+    return pointer;
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    size_t before = pointer ? malloc_usable_size(pointer) : 0;
+    void *moved = __libc_realloc(pointer, size);
+
+    if (moved) {
+        host_used += malloc_usable_size(moved) - before;
+        HOST_MALLOCS++;
+    }
+    else if (size == 0) {
+        host_used -= before;
+    }
+    return moved;
+}
+
+void free(void *pointer)
+{
+    if (pointer)
+        host_used -= malloc_usable_size(pointer);
+    __libc_free(pointer);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return HOST_HEAP - (uint32_t)host_used;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 * 1000 + ts.tv_nsec / 1000;
+}
+
+void mod_webserver_printf(httpd_req_t *req, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# mod_https against openssl s_server: full and resumed handshakes with a
+# pinned leaf and with a CA, and the cases that must fail.
+#
+# Usage: https_check.sh BUILD PORT
+#
+
+BUILD=$1
+PORT=$2
+OPENSSL=${OPENSSL:-openssl}
+COUNT=5
+
+$OPENSSL s_server -quiet -www -accept "$PORT" -cert "$BUILD/server.pem" -key "$BUILD/server.key" &
+SERVER=$!
+trap 'kill $SERVER' EXIT
+sleep 1
+
+status=0
+run() {
+    echo "== $*"
+    "$@" || { echo "FAIL"; status=1; }
+}
+
+run "$BUILD/https_pin" "https://localhost:$PORT/" $COUNT ok
+run "$BUILD/https_ca" "https://localhost:$PORT/" $COUNT ok
+run "$BUILD/https_badpin" "https://localhost:$PORT/" 2 fail
+# The certificate is for localhost, not the address
+run "$BUILD/https_pin" "https://127.0.0.1:$PORT/" 1 fail
+run "$BUILD/https_ca" "https://127.0.0.1:$PORT/" 1 fail
+run "$BUILD/https_none" "https://localhost:$PORT/" 1 refused
+
+exit $status
@@ -0,0 +1,85 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "mod_https.h"
+
+/* mod_https against a local TLS server, "openssl s_server -www" in
+   https_check.sh: COUNT requests on one mod_https_t, the first with a full
+   handshake and the others resuming its session. Prints the handshake
+   time and heap peak of each, as mod_https measures them.
+
+   The last argument is the expected outcome: "ok", "fail" when every
+   handshake must be rejected, or "refused" when mod_https_init must
+   refuse the URL for want of a trust anchor. */
+
+int main(int argc, char *argv[])
+{
+    static const char request[] = "GET / HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    mod_https_t https;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s URL COUNT ok|fail|refused\n", argv[0]);
+        return 2;
+    }
+    int count = atoi(argv[2]);
+    const char *expect = argv[3];
+
+    esp_err_t err = mod_https_init(&https, argv[1]);
+    if (strcmp(expect, "refused") == 0) {
+        printf("%s: init %s\n", argv[1], err == ESP_ERR_INVALID_STATE ? "refused" : "accepted");
+        return err != ESP_ERR_INVALID_STATE;
+    }
+    if (err != ESP_OK) {
+        printf("%s: init failed (%d)\n", argv[1], err);
+        return 1;
+    }
+
+    int opened = 0;
+    uint32_t full_ms = 0, full_heap = 0, resumed_ms = 0, resumed_heap = 0;
+    for (int i = 0; i < count; ++i) {
+        uint32_t resumed = HTTPS_RESUMED;
+        if (mod_https_open(&https) != ESP_OK) {
+            printf("%d: handshake rejected\n", i + 1);
+            continue;
+        }
+        int status = -1;
+        if (mod_https_write(NULL, request, sizeof(request) - 1) == sizeof(request) - 1)
+            status = mod_https_status(&https);
+        mod_https_close(&https);
+        opened++;
+
+        resumed = HTTPS_RESUMED - resumed;
+        printf("%d: %s handshake %u ms, heap peak %u B, status %d\n", i + 1, resumed ? "resumed" : "full",
+               HTTPS_HANDSHAKE_MS, HTTPS_HEAP_PEAK, status);
+        if (status != 200)
+            return 1;
+        if (resumed) {
+            resumed_ms = HTTPS_HANDSHAKE_MS > resumed_ms ? HTTPS_HANDSHAKE_MS : resumed_ms;
+            resumed_heap = HTTPS_HEAP_PEAK > resumed_heap ? HTTPS_HEAP_PEAK : resumed_heap;
+        }
+        else {
+            full_ms = HTTPS_HANDSHAKE_MS > full_ms ? HTTPS_HANDSHAKE_MS : full_ms;
+            full_heap = HTTPS_HEAP_PEAK > full_heap ? HTTPS_HEAP_PEAK : full_heap;
+        }
+    }
+
+    if (strcmp(expect, "fail") == 0) {
+        printf("%s: %d of %d handshakes rejected\n", argv[1], count - opened, count);
+        return opened != 0;
+    }
+    printf("%s: %u handshakes, %u resumed; full max %u ms %u B, resumed max %u ms %u B\n", argv[1],
+           HTTPS_HANDSHAKES, HTTPS_RESUMED, full_ms, full_heap, resumed_ms, resumed_heap);
+
+    return opened != count || HTTPS_RESUMED + 1 != HTTPS_HANDSHAKES;
+}
@@ -0,0 +1,181 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meter_queue.h"
+
+/* The upload schedule of a fleet of N devices. As mod_upload does, the
+   window is capped at the upload interval and every device sends a
+   record meter_queue_jitter(MAC, window) seconds after it was queued at
+   the boundary. The MACs share the Espressif OUI and are sequential from
+   a random start, as a batch of modules comes, or random with -r.
+
+   - schedule : requests per second over the window, against the same
+                fleet on offsets drawn at random, a chi-square of the
+                offsets over ten slices of the window, which has to stay
+                below 27.88 (p = 0.001), and the devices sending after
+                the interval closed, which has to be none
+   - outage   : the sink down for -o seconds from the boundary, every
+                device retrying after meter_queue_backoff with the
+                Kconfig defaults. Reported are the peak of requests per
+                second while down and after it came back, with and
+                without the random half of the backoff, and the time
+                the last device needed to deliver, which has to be
+                within the longest backoff. */
+
+#define JITTER_SLICES     10
+#define JITTER_CHI_SQUARE 27.88
+
+typedef struct fleet {
+    int devices;
+    uint32_t window;
+    uint32_t *offsets;
+} fleet_t;
+
+static uint32_t jitter_backoff_min = 30;
+static uint32_t jitter_backoff_max = 900;
+
+static uint32_t jitter_peak(const uint32_t *counts, uint32_t seconds)
+{
+    uint32_t peak = 0;
+
+    for (uint32_t i = 0; i < seconds; ++i)
+        if (counts[i] > peak)
+            peak = counts[i];
+    return peak;
+}
+
+static int jitter_schedule(const fleet_t *fleet, uint32_t interval)
+{
+    uint32_t *counts = calloc(fleet->window, sizeof(uint32_t));
+    uint32_t *uniform = calloc(fleet->window, sizeof(uint32_t));
+    uint32_t slices[JITTER_SLICES] = { 0 };
+    uint32_t late = 0;
+
+    for (int i = 0; i < fleet->devices; ++i) {
+        uint32_t offset = fleet->offsets[i];
+        counts[offset]++;
+        uniform[rand() % fleet->window]++;
+        slices[(uint64_t)offset * JITTER_SLICES / fleet->window]++;
+        if (offset >= interval * 60)
+            late++;
+    }
+
+    // Against the share of every slice, which the rounding of the window makes uneven
+    double chi = 0;
+    for (int s = 0; s < JITTER_SLICES; ++s) {
+        uint32_t from = ((uint64_t)fleet->window * s + JITTER_SLICES - 1) / JITTER_SLICES;
+        uint32_t to = ((uint64_t)fleet->window * (s + 1) + JITTER_SLICES - 1) / JITTER_SLICES;
+        double expected = (double)fleet->devices * (to - from) / fleet->window;
+        chi += (slices[s] - expected) * (slices[s] - expected) / expected;
+    }
+
+    int failed = late != 0 || chi >= JITTER_CHI_SQUARE;
+    printf("schedule  %u/s peak, %u/s at random offsets, %.2f/s mean, %u/s without jitter\n",
+           jitter_peak(counts, fleet->window), jitter_peak(uniform, fleet->window),
+           (double)fleet->devices / fleet->window, fleet->devices);
+    printf("          chi-square %.2f over %d slices, %u late  %s\n", chi, JITTER_SLICES, late, failed ? "FAIL" : "ok");
+
+    free(counts);
+    free(uniform);
+    return failed;
+}
+
+// Returns the seconds from the end of the outage until the last device delivered
+static uint32_t jitter_outage(const fleet_t *fleet, uint32_t outage, int random, uint32_t *down, uint32_t *up)
+{
+    uint32_t seconds = outage + jitter_backoff_max + fleet->window + 1;
+    uint32_t *counts = calloc(seconds, sizeof(uint32_t));
+    uint32_t last = 0;
+
+    for (int i = 0; i < fleet->devices; ++i) {
+        uint32_t t = fleet->offsets[i];
+        uint32_t attempts = 0;
+
+        // As upload_task, a failure backs off and keeps the record at the head
+        for (;;) {
+            counts[t]++;
+            if (t >= outage)
+                break;
+            attempts++;
+            t += meter_queue_backoff(attempts, jitter_backoff_min, jitter_backoff_max, random ? (uint32_t)rand() : 0);
+        }
+        if (t - outage > last)
+            last = t - outage;
+    }
+
+    *down = jitter_peak(counts, outage);
+    *up = jitter_peak(counts + outage, seconds - outage);
+    free(counts);
+
+    return last;
+}
+
+int main(int argc, char *argv[])
+{
+    fleet_t fleet = { .devices = 1000, .window = 600 };
+    uint32_t interval = 15;
+    uint32_t outage = 3600;
+    int random = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            fleet.devices = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            fleet.window = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            outage = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            random = 1;
+        else {
+            fprintf(stderr, "usage: %s [-n devices] [-w window s] [-i interval min] [-o outage s] [-r]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (fleet.devices < 1 || interval < 1 || interval > 60) {
+        fprintf(stderr, "1 device at least, an interval of 1 to 60 min\n");
+        return 2;
+    }
+
+    // As mod_upload, every interval is first tried before the next one closes
+    if (fleet.window > interval * 60)
+        fleet.window = interval * 60;
+    if (fleet.window == 0)
+        fleet.window = 1;
+
+    srand(1);
+    fleet.offsets = malloc(fleet.devices * sizeof(uint32_t));
+    uint32_t base = rand() & 0xFFFFFF;
+    for (int i = 0; i < fleet.devices; ++i) {
+        uint32_t nic = random ? (uint32_t)rand() & 0xFFFFFF : (base + i) & 0xFFFFFF;
+        uint8_t mac[6] = { 0x24, 0x0A, 0xC4, nic >> 16, nic >> 8, nic };
+        fleet.offsets[i] = meter_queue_jitter(mac, fleet.window);
+    }
+
+    printf("%d devices, %s MACs, %u s window, %u min interval\n", fleet.devices, random ? "random" : "sequential",
+           fleet.window, interval);
+    int errors = jitter_schedule(&fleet, interval);
+
+    uint32_t down, up, fixed_down, fixed_up;
+    uint32_t last = jitter_outage(&fleet, outage, 1, &down, &up);
+    jitter_outage(&fleet, outage, 0, &fixed_down, &fixed_up);
+    int failed = last > jitter_backoff_max;
+    printf("outage    %u s, %u/s peak down, %u/s back up, %u/s and %u/s without random backoff\n",
+           outage, down, up, fixed_down, fixed_up);
+    printf("          last delivered %u s after, %u s longest backoff  %s\n", last, jitter_backoff_max, failed ? "FAIL" : "ok");
+    errors += failed;
+
+    free(fleet.offsets);
+    return errors != 0;
+}
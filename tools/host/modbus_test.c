@@ -0,0 +1,269 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meter_modbus.h"
+
+/* meter_modbus against a simulated slave on a pty. The master side does
+   what modbus_read in mod_modbus.c does with the UART: flush the input,
+   send the request, read the expected response length within 200 ms and
+   check it with meter_modbus_response(). The slave thread answers
+   function 0x04 reads from a register file where the float at address A
+   is A * 10 + 0.25, sleeps the wire time of request and response at the
+   baud rate plus a 3.5 character turnaround, flips one bit of a response
+   at the -e rate (1/1000) and answers reads beyond SLAVE_REGISTERS with
+   exception 0x02, which the master only takes after its timeout, as
+   the UART read waits for the full length.
+
+   Reported are reads, CRC errors against the injected ones, exceptions,
+   timeouts and the latency from request to complete response. Every value
+   of an accepted response has to match the register file, and every
+   injected error has to be caught. */
+
+#define SLAVE_REGISTERS 0x200
+#define MASTER_TIMEOUT  200
+
+typedef struct slave {
+    int fd;
+    int baud;
+    int permille;
+    uint8_t address;
+    uint32_t requests;
+    uint32_t corrupted;
+} slave_t;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 * 1000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t slave_value(uint16_t address)
+{
+    float value = address * 10 + 0.25f;
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static void slave_crc(uint8_t *frame, int length)
+{
+    uint16_t crc = meter_modbus_crc(frame, length);
+
+    frame[length] = crc & 0xFF;
+    frame[length + 1] = crc >> 8;
+}
+
+static void *slave_task(void *parameter)
+{
+    slave_t *slave = parameter;
+    uint8_t request[8];
+    uint8_t response[5 + 2 * 125];
+    int length = 0;
+
+    for (;;) {
+        int ret = read(slave->fd, request + length, sizeof(request) - length);
+        if (ret <= 0)
+            return NULL;
+        length += ret;
+        if (length < (int)sizeof(request))
+            continue;
+        length = 0;
+
+        uint16_t crc = meter_modbus_crc(request, 6);
+        if (request[0] != slave->address || request[6] != (crc & 0xFF) || request[7] != (crc >> 8))
+            continue;
+        slave->requests++;
+
+        uint16_t address = request[2] << 8 | request[3];
+        uint16_t count = request[4] << 8 | request[5];
+        int size;
+        response[0] = slave->address;
+        if (request[1] != 0x04 || count == 0 || count > 125 || (count & 1) || address + count > SLAVE_REGISTERS) {
+            response[1] = request[1] | 0x80;
+            response[2] = request[1] != 0x04 ? 0x01 : 0x02;
+            size = 3;
+        }
+        else {
+            response[1] = 0x04;
+            response[2] = 2 * count;
+            for (int i = 0; i < count; i += 2) {
+                uint32_t bits = slave_value(address + i);
+                response[3 + 2 * i] = bits >> 24;
+                response[4 + 2 * i] = bits >> 16;
+                response[5 + 2 * i] = bits >> 8;
+                response[6 + 2 * i] = bits;
+            }
+            size = 3 + 2 * count;
+        }
+        slave_crc(response, size);
+        size += 2;
+
+        if (rand() % 1000 < slave->permille) {
+            response[rand() % size] ^= 1 << (rand() % 8);
+            slave->corrupted++;
+        }
+
+        // 10 bits per character on the wire, and the 3.5 character gap that ends a frame
+        usleep((sizeof(request) + size + 3.5) * 10 * 1000 * 1000 / slave->baud);
+        if (write(slave->fd, response, size) != size)
+            return NULL;
+    }
+}
+
+static int master_read(int fd, meter_modbus_t *modbus, int batch, uint32_t *latency)
+{
+    uint8_t frame[METER_MODBUS_FRAME];
+    int length = meter_modbus_request(modbus, batch, frame);
+    int expected = meter_modbus_response_length(modbus, batch);
+    int received = 0;
+
+    tcflush(fd, TCIFLUSH);
+    int64_t start = now_us();
+    if (write(fd, frame, length) != length)
+        return METER_MODBUS_FORMAT;
+
+    // As uart_read_bytes, up to the expected length or the timeout
+    while (received < expected) {
+        int remaining = MASTER_TIMEOUT - (int)((now_us() - start) / 1000);
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0)
+            break;
+        int ret = read(fd, frame + received, expected - received);
+        if (ret <= 0)
+            break;
+        received += ret;
+    }
+    *latency = now_us() - start;
+
+    return meter_modbus_response(modbus, batch, frame, received);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *map = "voltage:0,current:6,power:12,pf:30,import:0x48,export:0x4A";
+    slave_t slave = { .baud = 9600, .permille = 20, .address = 1 };
+    int polls = 200;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            polls = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+            slave.permille = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            slave.baud = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            map = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-n polls] [-e crc errors per 1000] [-b baud] [-m map]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    meter_modbus_t modbus;
+    if (meter_modbus_parse(&modbus, slave.address, map) != 0) {
+        fprintf(stderr, "Invalid register map %s\n", map);
+        return 2;
+    }
+
+    // The slave owns the pty master, the meter opens the terminal like a UART
+    slave.fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (slave.fd < 0 || grantpt(slave.fd) != 0 || unlockpt(slave.fd) != 0) {
+        perror("posix_openpt");
+        return 2;
+    }
+    int fd = open(ptsname(slave.fd), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (fd < 0 || tcgetattr(fd, &tio) != 0) {
+        perror(ptsname(slave.fd));
+        return 2;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    pthread_t thread;
+    srand(1);
+    pthread_create(&thread, NULL, slave_task, &slave);
+
+    uint32_t reads = 0, ok = 0, crc_errors = 0, exceptions = 0, timeouts = 0, mismatches = 0, beyond = 0;
+    uint32_t latency_max = 0;
+    uint64_t latency_sum = 0;
+    for (int poll = 0; poll < polls; ++poll) {
+        for (int batch = 0; batch < modbus.batch_count; ++batch) {
+            for (int i = 0; i < modbus.count; ++i)
+                modbus.registers[i].value = -1;
+
+            uint32_t latency;
+            int result = master_read(fd, &modbus, batch, &latency);
+            reads++;
+            if (modbus.batches[batch].address + modbus.batches[batch].count > SLAVE_REGISTERS)
+                beyond++;
+            switch (result) {
+            case METER_MODBUS_OK:
+                ok++;
+                latency_sum += latency;
+                if (latency > latency_max)
+                    latency_max = latency;
+                break;
+            case METER_MODBUS_CRC:
+                crc_errors++;
+                continue;
+            case METER_MODBUS_EXCEPTION:
+                exceptions++;
+                continue;
+            default:
+                timeouts++;
+                continue;
+            }
+
+            const meter_modbus_batch_t *b = &modbus.batches[batch];
+            for (int i = 0; i < modbus.count; ++i) {
+                meter_modbus_register_t *reg = &modbus.registers[i];
+                if (reg->address < b->address || reg->address + 2 > b->address + b->count)
+                    continue;
+                if (reg->value != reg->address * 10000 + 250) {
+                    printf("  %s: %d, expected %d\n", reg->name, reg->value, reg->address * 10000 + 250);
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    printf("map       %s\n", map);
+    printf("reads     %u in %d batches, %u ok, %u timeout\n", reads, modbus.batch_count, ok, timeouts);
+    printf("crc       %u errors (%u.%u%%), %u injected\n", crc_errors,
+           crc_errors * 1000 / reads / 10, crc_errors * 1000 / reads % 10, slave.corrupted);
+    printf("exception %u, %u reads beyond the slave's registers\n", exceptions, beyond);
+    printf("latency   %u us average, %u us max at %d baud\n", ok ? (uint32_t)(latency_sum / ok) : 0, latency_max, slave.baud);
+    printf("values    %u mismatches\n", mismatches);
+
+    // Reads beyond the registers end in an exception unless corrupted on the way
+    int failed = mismatches != 0 || crc_errors != slave.corrupted || timeouts != 0 || exceptions > beyond || ok > reads - beyond;
+    printf("%s\n", failed ? "FAIL" : "ok");
+
+    close(fd);
+    close(slave.fd);
+    pthread_join(thread, NULL);
+
+    return failed;
+}
@@ -0,0 +1,436 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meter_channel.h"
+#include "meter_time.h"
+
+/* Replays a pulse train through meter_channel the way pulse_task does on
+   the device: every input edge to meter_channel_edge(), every accepted
+   pulse to meter_channel_pulse() and meter_channel_count() at its local
+   second, and meter_channel_advance() at every minute of the monotonic
+   clock. The local clock is the monotonic one plus an offset, which the
+   DST and step scenarios change under way.
+
+   The reference counts the real pulses of the train into dense arrays of
+   local hours with the store's rule for a clock stepped back (a pulse
+   behind the newest minute counts into that minute), and the result is
+   checked against meter_store_hours() for the days still held with hourly
+   resolution, meter_store_day() for every day and the lifetime total.
+   The cost is the wall time of the meter_channel calls per accepted
+   pulse, two clock reads per edge included.
+
+   A train is either synthetic or a CSV of "time_us,level,offset_s[,real]"
+   rows; without the real column every low pulse counts as real. -w writes
+   the synthetic trains in that format. */
+
+#define REPLAY_IMP_KWH   1000
+#define REPLAY_WIDTH     30000
+#define REPLAY_MINUTE    (60LL * 1000 * 1000)
+
+typedef struct replay_event {
+    int64_t time;
+    int64_t offset;
+    int level;
+    int real;
+} replay_event_t;
+
+typedef struct replay_clock {
+    int64_t time;
+    int64_t delta;
+} replay_clock_t;
+
+typedef struct replay_train {
+    const char *name;
+    int32_t first_day;
+    int days;
+    uint32_t (*load)(const struct replay_train *train, int64_t local);
+    int noise;
+    replay_clock_t clocks[4];
+    int clock_count;
+
+    // Generator state
+    int64_t end;
+    int64_t offset;
+    int64_t pulse;
+    int phase;
+    uint32_t random;
+    FILE *csv;
+} replay_train_t;
+
+typedef struct replay_reference {
+    int32_t first_day;
+    int days;
+    uint32_t (*hours)[24];
+    int32_t minute;
+    uint64_t total;
+} replay_reference_t;
+
+// Synthetic loads (W) by local second
+
+static uint32_t replay_constant(const replay_train_t *train, int64_t local)
+{
+    return 1000;
+}
+
+static uint32_t replay_burst(const replay_train_t *train, int64_t local)
+{
+    // 20 kW for 10 minutes of every hour, 300 W otherwise
+    return local % 3600 < 600 ? 20000 : 300;
+}
+
+static uint32_t replay_daily(const replay_train_t *train, int64_t local)
+{
+    int hour = local % 86400 / 3600;
+    return hour < 6 ? 250 : hour < 18 ? 1500 : 3000;
+}
+
+static uint32_t replay_xorshift(replay_train_t *train)
+{
+    train->random ^= train->random << 13;
+    train->random ^= train->random >> 17;
+    train->random ^= train->random << 5;
+    return train->random;
+}
+
+static int64_t replay_offset(const replay_train_t *train, int64_t time)
+{
+    int64_t offset = (int64_t)train->first_day * 86400;
+
+    for (int i = 0; i < train->clock_count; ++i) {
+        if (train->clocks[i].time <= time)
+            offset += train->clocks[i].delta;
+    }
+
+    return offset;
+}
+
+// A clock change at a local time, before any earlier change takes effect
+static void replay_clock(replay_train_t *train, int32_t day, int hour, int64_t delta)
+{
+    int64_t local = (int64_t)day * 86400 + hour * 3600;
+    int64_t time = (local - replay_offset(train, INT64_MAX)) * 1000 * 1000;
+
+    train->clocks[train->clock_count].time = time;
+    train->clocks[train->clock_count].delta = delta;
+    train->clock_count++;
+}
+
+static int replay_generate(replay_train_t *train, replay_event_t *event)
+{
+    // Phases: 0 leading edge, 1 trailing edge, 2 and 3 a glitch in the gap
+    for (;;) {
+        int64_t offset = replay_offset(train, train->pulse);
+        uint32_t load = train->load(train, train->pulse / (1000 * 1000) + offset);
+        int64_t interval = 3600LL * 1000 * 1000 * 1000 / ((int64_t)load * REPLAY_IMP_KWH);
+
+        if (train->pulse >= train->end)
+            return 0;
+
+        event->offset = offset;
+        event->real = 0;
+        switch (train->phase++) {
+            case 0:
+                event->time = train->pulse;
+                event->level = 0;
+                return 1;
+            case 1:
+                event->time = train->pulse + REPLAY_WIDTH;
+                event->level = 1;
+                event->real = 1;
+                if (!train->noise)
+                    train->phase = 4;
+                return 1;
+            case 2:
+                event->time = train->pulse + REPLAY_WIDTH + interval / 2;
+                event->level = 0;
+                return 1;
+            case 3:
+                event->time = train->pulse + REPLAY_WIDTH + interval / 2 + 50 + replay_xorshift(train) % 250;
+                event->level = 1;
+                return 1;
+            default:
+                train->pulse += interval;
+                train->phase = 0;
+                break;
+        }
+    }
+}
+
+static int replay_read(replay_train_t *train, replay_event_t *event)
+{
+    char line[128];
+    long long time, offset;
+    int level, real;
+
+    while (fgets(line, sizeof(line), train->csv)) {
+        int fields = sscanf(line, "%lld,%d,%lld,%d", &time, &level, &offset, &real);
+        if (fields < 3)
+            continue;
+        event->time = time;
+        event->level = level;
+        event->offset = offset;
+        event->real = fields == 4 ? real : level == 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Reference
+
+static void reference_count(replay_reference_t *reference, int32_t minute, uint32_t count)
+{
+    if (minute > reference->minute)
+        reference->minute = minute;
+    minute = reference->minute;
+
+    int32_t day = minute / 1440 - reference->first_day;
+    if (day < 0 || day >= reference->days)
+        return;
+    reference->hours[day][minute / 60 % 24] += count;
+    reference->total += count;
+}
+
+static int reference_check(const replay_reference_t *reference, const meter_store_t *store, int *hours_checked, int *days_checked)
+{
+    int32_t last = store->minute / 1440;
+    int errors = 0;
+
+    *hours_checked = 0;
+    *days_checked = 0;
+    for (int i = 0; i < reference->days; ++i) {
+        int32_t day = reference->first_day + i;
+        uint32_t hours[24];
+        uint32_t total = 0;
+
+        if (day > last)
+            break;
+        for (int hour = 0; hour < 24; ++hour)
+            total += reference->hours[i][hour];
+
+        // Closed days stay with hourly resolution until the arena evicts them
+        if (meter_store_hours(store, day, hours) || (total && last - day < METER_STORE_HOUR_DAYS / 2)) {
+            for (int hour = 0; hour < 24; ++hour) {
+                if (hours[hour] != reference->hours[i][hour]) {
+                    if (errors++ < 8)
+                        printf("  day %d hour %d: %u, expected %u\n", day, hour, hours[hour], reference->hours[i][hour]);
+                }
+            }
+            *hours_checked += 24;
+        }
+
+        uint32_t counted = meter_store_day(store, day);
+        if (counted != total) {
+            if (errors++ < 8)
+                printf("  day %d: %u, expected %u\n", day, counted, total);
+        }
+        (*days_checked)++;
+    }
+
+    if (store->lifetime != reference->total) {
+        printf("  lifetime: %llu, expected %llu\n", (unsigned long long)store->lifetime, (unsigned long long)reference->total);
+        errors++;
+    }
+
+    return errors;
+}
+
+static int64_t replay_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static int replay_run(replay_train_t *train, FILE *out)
+{
+    meter_channel_t channel;
+    meter_store_t *store = calloc(1, sizeof(meter_store_t));
+    meter_event_t *event_state = calloc(1, sizeof(meter_event_t));
+    meter_load_t *load = calloc(1, sizeof(meter_load_t));
+    replay_reference_t reference = { 0 };
+    replay_event_t event;
+    int64_t pending = -1;
+    int64_t tick = REPLAY_MINUTE;
+    int64_t offset = (int64_t)train->first_day * 86400;
+    uint64_t edges = 0;
+    uint64_t pulses = 0;
+    int64_t elapsed = 0;
+
+    meter_channel_init(&channel, REPLAY_IMP_KWH, 500, 200000, 100000, 900);
+    meter_channel_attach(&channel, store, event_state, load, 300 * 1000);
+    reference.first_day = train->first_day;
+    reference.days = train->days + 2;
+    reference.hours = calloc(reference.days, sizeof(*reference.hours));
+    reference.minute = -1;
+    train->pulse = 1000 * 1000;
+    train->end = train->pulse + (int64_t)train->days * 86400 * 1000 * 1000;
+    train->random = 2463534242u;
+
+    for (;;) {
+        int more = train->csv ? replay_read(train, &event) : replay_generate(train, &event);
+        if (!more)
+            break;
+        if (out)
+            fprintf(out, "%lld,%d,%lld,%d\n", (long long)event.time, event.level, (long long)event.offset, event.real);
+
+        // The first edge sets the clocks
+        if (edges == 0) {
+            tick = event.time - event.time % REPLAY_MINUTE + REPLAY_MINUTE;
+            offset = event.offset;
+        }
+
+        int64_t start = replay_now();
+
+        // Minute boundaries up to the edge, with the local time they happen at
+        while (tick <= event.time) {
+            int64_t second = tick / (1000 * 1000) + offset;
+            meter_channel_advance(&channel, tick, second);
+            if (second / 60 > reference.minute)
+                reference.minute = second / 60;
+            tick += REPLAY_MINUTE;
+        }
+        offset = event.offset;
+
+        int64_t pulse_time;
+        meter_event_step_t step;
+        edges++;
+        if (meter_channel_edge(&channel, event.time, event.level, &pulse_time)) {
+            int64_t second = pulse_time / (1000 * 1000) + offset;
+            meter_channel_pulse(&channel, pulse_time, &step);
+            meter_channel_count(&channel, pulse_time, second, 1, 1);
+            pulses++;
+        }
+        elapsed += replay_now() - start;
+
+        // The reference takes the leading edge of each real pulse
+        if (event.level == 0)
+            pending = event.time / (1000 * 1000) + event.offset;
+        if (event.real && pending >= 0) {
+            reference_count(&reference, pending / 60, 1);
+            pending = -1;
+        }
+    }
+
+    int hours_checked, days_checked;
+    int errors = reference_check(&reference, store, &hours_checked, &days_checked);
+    double ns = pulses ? (double)elapsed / pulses : 0;
+    printf("%-9s %9llu %9llu %6d %5d %9.1f %11.0f  %s\n", train->name,
+           (unsigned long long)pulses, (unsigned long long)edges, hours_checked, days_checked,
+           ns, ns > 0 ? 1e9 / ns : 0, errors ? "FAIL" : "ok");
+
+    free(reference.hours);
+    free(store);
+    free(event_state);
+    free(load);
+
+    return errors;
+}
+
+static void replay_scenario(replay_train_t *train, const char *name)
+{
+    memset(train, 0, sizeof(replay_train_t));
+    train->name = name;
+    train->load = replay_constant;
+    train->first_day = meter_time_days(2024, 1, 10);
+    train->days = 40;
+
+    if (strcmp(name, "burst") == 0) {
+        train->load = replay_burst;
+        train->days = 10;
+    }
+    else if (strcmp(name, "noise") == 0) {
+        train->load = replay_daily;
+        train->noise = 1;
+        train->days = 20;
+    }
+    else if (strcmp(name, "dst") == 0) {
+        // Last Sundays of March and October, CET
+        train->load = replay_daily;
+        train->first_day = meter_time_days(2024, 3, 25);
+        train->days = 220;
+        replay_clock(train, meter_time_days(2024, 3, 31), 2, 3600);
+        replay_clock(train, meter_time_days(2024, 10, 27), 3, -3600);
+    }
+    else if (strcmp(name, "step") == 0) {
+        // SNTP corrections: 20 minutes back at noon, two hours ahead in the evening
+        train->load = replay_daily;
+        train->days = 5;
+        replay_clock(train, train->first_day + 2, 12, -1200);
+        replay_clock(train, train->first_day + 3, 20, 7200);
+    }
+    else if (strcmp(name, "month") == 0) {
+        // A leap day, three month ends and a year end
+        train->load = replay_daily;
+        train->first_day = meter_time_days(2023, 12, 28);
+        train->days = 70;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const char * const scenarios[] = { "constant", "burst", "noise", "dst", "step", "month" };
+    const char *only = NULL;
+    const char *csv = NULL;
+    const char *write = NULL;
+    replay_train_t train;
+    int errors = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            csv = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            write = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-s constant|burst|noise|dst|step|month] [-c train.csv] [-w train.csv]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-9s %9s %9s %6s %5s %9s %11s\n", "train", "pulses", "edges", "hours", "days", "ns/pulse", "pulses/s");
+    if (csv) {
+        replay_scenario(&train, "csv");
+        train.csv = fopen(csv, "r");
+        if (train.csv == NULL) {
+            perror(csv);
+            return 2;
+        }
+        // The first row dates the train
+        char line[128];
+        long long time, offset;
+        int level;
+        if (fgets(line, sizeof(line), train.csv) && sscanf(line, "%lld,%d,%lld", &time, &level, &offset) == 3)
+            train.first_day = (time / (1000 * 1000) + offset) / 86400;
+        rewind(train.csv);
+        train.days = 3660;
+        errors += replay_run(&train, NULL);
+        fclose(train.csv);
+        return errors != 0;
+    }
+
+    FILE *out = write ? fopen(write, "w") : NULL;
+    for (int i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+        if (only && strcmp(only, scenarios[i]) != 0)
+            continue;
+        replay_scenario(&train, scenarios[i]);
+        errors += replay_run(&train, out);
+    }
+    if (out)
+        fclose(out);
+
+    return errors != 0;
+}
@@ -0,0 +1,392 @@
+/* ESProom
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_system.h"
+#include "meter_time.h"
+#include "meter_upload.h"
+
+/* The batched backends against a local HTTP stand-in. The client does
+   what upload_post in mod_upload.c does on a kept connection: a length
+   pass of the encoder, the request line and headers, then the body
+   streamed through meter_form. A day of random minute buckets of every
+   channel is sent three ways:
+
+   - metric : one InfluxDB request per channel and minute, and one per
+              minute for the environment, as before the batching
+   - influx : one request per interval with all channels and the
+              environment, shrunk as upload_window does until the body
+              fits in the buffer size
+   - json   : the same batches as JSON
+   - influx h, json h : the day as hour buckets, as a backlog older than
+              the minute ring is sent
+
+   The stand-in thread answers every request with 204 and records the
+   request count, the bytes of the requests and their bodies, and the
+   pulses it reads back from the bodies, which have to add up to the
+   pulses sent. -w FILE appends every body it receives to FILE.
+
+   The allocations are counted by the malloc of host.c around every
+   request after the first, which has to be 0 for the encoding and the
+   streaming of a body on an open connection.
+
+   The timestamps of a backlog come from meter_time_epoch, its chunks end
+   where meter_time_run finds the UTC offset changing. Both are checked
+   under the central European rules on the DST days of 2024. */
+
+#define UPLOAD_DAY 1440
+
+typedef void (*upload_encode_t)(meter_form_t *form, const meter_upload_batch_t *batch);
+
+typedef struct standin {
+    int listen;
+    FILE *record;
+    uint32_t requests;
+    uint64_t bytes;
+    uint64_t body;
+    uint64_t pulses;
+} standin_t;
+
+static standin_t standin;
+static int upload_channels = 2;
+static int upload_interval = 15;
+static int upload_buffer = 1024;
+static uint16_t upload_counts[METER_UPLOAD_CHANNELS][UPLOAD_DAY];
+static meter_upload_batch_t upload_batch;
+static const char *upload_names[METER_UPLOAD_CHANNELS] = { "mains", "heat pump", "solar", "ev" };
+
+// Stand-in, which allocates nothing so that the count is the client's
+static uint64_t standin_pulses(char *body, int length)
+{
+    char end = body[length];
+    uint64_t pulses = 0;
+    char *p = body;
+
+    body[length] = 0;
+    // InfluxDB lines carry pulses=Ni, JSON objects "pulses":[N,...]
+    while ((p = strstr(p, "pulses")) != NULL) {
+        p += 6;
+        if (*p == '=') {
+            pulses += strtoul(p + 1, &p, 10);
+            continue;
+        }
+        if (strncmp(p, "\":[", 3) != 0)
+            continue;
+        p += 3;
+        while (*p != ']' && *p) {
+            pulses += strtoul(p, &p, 10);
+            if (*p == ',')
+                p++;
+        }
+    }
+    body[length] = end;
+
+    return pulses;
+}
+
+static void *standin_task(void *parameter)
+{
+    static char request[65536 + 1];
+
+    for (;;) {
+        int fd = accept(standin.listen, NULL, NULL);
+        int used = 0;
+        if (fd < 0)
+            return NULL;
+
+        for (;;) {
+            int ret = read(fd, request + used, sizeof(request) - 1 - used);
+            if (ret <= 0)
+                break;
+            used += ret;
+
+            // Every complete request in the buffer
+            char *end;
+            while ((end = memmem(request, used, "\r\n\r\n", 4)) != NULL) {
+                int header = end + 4 - request;
+                char *field = strcasestr(request, "Content-Length:");
+                int length = field && field < end ? atoi(field + 15) : 0;
+                if (used < header + length)
+                    break;
+
+                standin.requests++;
+                standin.bytes += header + length;
+                standin.body += length;
+                standin.pulses += standin_pulses(request + header, length);
+                if (standin.record) {
+                    fwrite(request + header, 1, length, standin.record);
+                    if (length && request[header + length - 1] != '\n')
+                        fputc('\n', standin.record);
+                }
+
+                static const char response[] = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+                if (write(fd, response, sizeof(response) - 1) != sizeof(response) - 1)
+                    break;
+                memmove(request, request + header + length, used - header - length);
+                used -= header + length;
+            }
+        }
+        close(fd);
+    }
+}
+
+// Client
+static int upload_write(void *context, const char *data, int length)
+{
+    int fd = *(int*)context;
+
+    return write(fd, data, length) == length ? length : -1;
+}
+
+static int upload_post(int fd, int port, upload_encode_t encode, const char *content_type)
+{
+    char header[256];
+    char response[128];
+    meter_form_t form;
+
+    // Length
+    meter_form_init(&form, NULL, NULL);
+    encode(&form, &upload_batch);
+    int32_t length = meter_form_finish(&form);
+
+    int size = snprintf(header, sizeof(header),
+                        "POST /write HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+                        port, content_type, length);
+    if (write(fd, header, size) != size)
+        return -1;
+
+    // Body
+    meter_form_init(&form, upload_write, &fd);
+    encode(&form, &upload_batch);
+    if (meter_form_finish(&form) != length)
+        return -1;
+
+    // The 204 of the stand-in, which has no body
+    int used = 0;
+    while (memmem(response, used, "\r\n\r\n", 4) == NULL) {
+        int ret = read(fd, response + used, sizeof(response) - used);
+        if (ret <= 0)
+            return -1;
+        used += ret;
+    }
+    return strncmp(response, "HTTP/1.1 204", 12) == 0 ? 0 : -1;
+}
+
+// As upload_window, the buckets of the batch in proportion until the body fits
+static void upload_fit(upload_encode_t encode)
+{
+    for (;;) {
+        meter_form_t form;
+        meter_form_init(&form, NULL, NULL);
+        encode(&form, &upload_batch);
+        int32_t length = meter_form_finish(&form);
+        if (length <= upload_buffer || upload_batch.buckets == 1)
+            break;
+        uint32_t buckets = (uint32_t)upload_batch.buckets * upload_buffer / length;
+        upload_batch.buckets = buckets == 0 ? 1 : buckets < upload_batch.buckets ? buckets : upload_batch.buckets - 1;
+    }
+}
+
+// Buckets of interval seconds from the first minute, which starts one
+static void upload_fill(int first, int minutes, int interval, int channel, int channels, int environment)
+{
+    int size = interval / 60;
+
+    upload_batch.time = 1700000000 + first * 60;
+    upload_batch.interval = interval;
+    upload_batch.buckets = minutes / size;
+    upload_batch.channels = channels;
+    upload_batch.environment = environment;
+    for (int c = 0; c < channels; ++c) {
+        meter_upload_channel_t *batch = &upload_batch.channel[c];
+        batch->name = upload_names[channel + c];
+        batch->imp_kwh = 1000;
+        for (int b = 0; b < upload_batch.buckets; ++b) {
+            uint32_t count = 0;
+            for (int m = 0; m < size; ++m)
+                count += upload_counts[channel + c][first + b * size + m];
+            if (interval == 60)
+                batch->counts[b] = count;
+            else
+                batch->hours[b] = count;
+        }
+    }
+    upload_batch.env.time = upload_batch.time + minutes * 60 - 30;
+}
+
+// Batches of buckets of interval seconds, or one request per metric and minute without
+static int upload_run(const char *name, int port, upload_encode_t encode, const char *content_type, int interval, uint64_t expected)
+{
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    uint32_t mallocs = 0;
+    uint32_t requests = 0;
+    int failed = 0;
+
+    // Without Nagle the small writes of meter_form do not wait for delayed ACKs
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int nodelay = 1;
+    if (fd < 0 || setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) != 0 ||
+        connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        perror("connect");
+        return 1;
+    }
+    standin_t before = standin;
+
+    for (int minute = 0; minute < UPLOAD_DAY && !failed; ) {
+        // The sends of this step: one batch, or every metric of one minute
+        int sends = interval ? 1 : upload_channels + 1;
+        int step = 1;
+        for (int send = 0; send < sends; ++send) {
+            if (!interval)
+                upload_fill(minute, 1, 60, send < upload_channels ? send : 0, send < upload_channels, send == upload_channels);
+            else {
+                // An upload interval of minutes, or the rest of the day in hours
+                int span = interval == 60 ? upload_interval - minute % upload_interval : UPLOAD_DAY - minute;
+                if (span > UPLOAD_DAY - minute)
+                    span = UPLOAD_DAY - minute;
+                upload_fill(minute, span, interval, 0, upload_channels, 1);
+                upload_fit(encode);
+                step = upload_batch.buckets * interval / 60;
+            }
+
+            uint32_t start = HOST_MALLOCS;
+            if (upload_post(fd, port, encode, content_type) != 0) {
+                failed = 1;
+                break;
+            }
+            if (requests++)
+                mallocs += HOST_MALLOCS - start;
+        }
+        minute += step;
+    }
+    close(fd);
+
+    uint32_t count = standin.requests - before.requests;
+    uint64_t bytes = standin.bytes - before.bytes;
+    uint64_t body = standin.body - before.body;
+    uint64_t pulses = standin.pulses - before.pulses;
+    failed |= count != requests || pulses != expected || mallocs != 0;
+    printf("%-8s %8u %10llu %10llu %8llu %8u %10llu  %s\n", name, count, (unsigned long long)bytes, (unsigned long long)body,
+           (unsigned long long)(count ? body / count : 0), mallocs, (unsigned long long)pulses, failed ? "FAIL" : "ok");
+
+    return failed;
+}
+
+// Local days and minutes of the clock changes, and their UTC epochs
+static int upload_dst(void)
+{
+    int32_t spring = meter_time_days(2024, 3, 31) * 1440;
+    int32_t autumn = meter_time_days(2024, 10, 27) * 1440;
+    int32_t summer = meter_time_days(2024, 6, 1) * 1440;
+    int failed = 0;
+
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+
+    // 02:00 to 03:00 does not exist in spring, the offset changes at 03:00
+    failed |= meter_time_epoch(spring) != (int64_t)spring * 60 - 3600;
+    failed |= meter_time_epoch(spring + 240) != (int64_t)(spring + 240) * 60 - 7200;
+    failed |= meter_time_run(spring, 1440) != 180;
+    failed |= meter_time_run(spring + 180, 1440) != 1440;
+
+    // 02:00 to 03:00 repeats in autumn, at either offset
+    int32_t run = meter_time_run(autumn, 1440);
+    failed |= meter_time_epoch(autumn) != (int64_t)autumn * 60 - 7200;
+    failed |= meter_time_epoch(autumn + 240) != (int64_t)(autumn + 240) * 60 - 3600;
+    failed |= run != 120 && run != 180;
+
+    failed |= meter_time_run(summer, 1440) != 1440;
+    failed |= meter_time_run(summer + 10, 100) != 100;
+
+    printf("dst      %d and %d min at one offset from midnight  %s\n", meter_time_run(spring, 1440), run, failed ? "FAIL" : "ok");
+    unsetenv("TZ");
+    tzset();
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *record = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            upload_channels = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            upload_interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            upload_buffer = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            record = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-c channels] [-i interval min] [-b buffer size] [-w bodies.txt]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (upload_channels < 1 || upload_channels > METER_UPLOAD_CHANNELS || upload_interval < 1 || upload_interval > 60) {
+        fprintf(stderr, "1 to %d channels, an interval of 1 to 60 min\n", METER_UPLOAD_CHANNELS);
+        return 2;
+    }
+
+    if (record && (standin.record = fopen(record, "w")) == NULL) {
+        perror(record);
+        return 2;
+    }
+
+    // The stand-in on a free port of the loopback
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t size = sizeof(address);
+    standin.listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (standin.listen < 0 || bind(standin.listen, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(standin.listen, 1) != 0 || getsockname(standin.listen, (struct sockaddr*)&address, &size) != 0) {
+        perror("listen");
+        return 2;
+    }
+    int port = ntohs(address.sin_port);
+    pthread_t thread;
+    pthread_create(&thread, NULL, standin_task, NULL);
+
+    // A day of buckets, up to 60 pulses a minute
+    uint64_t expected = 0;
+    srand(1);
+    upload_batch.device = "ESProom";
+    for (int c = 0; c < upload_channels; ++c) {
+        for (int m = 0; m < UPLOAD_DAY; ++m) {
+            upload_counts[c][m] = rand() % 61;
+            expected += upload_counts[c][m];
+        }
+    }
+    upload_batch.env = (meter_upload_environment_t){ 0, 2153, 4820, 101325, 152340, 4250, 61200, 98 };
+
+    printf("%d channels, %d min interval, %d B buffer, %llu pulses a day\n", upload_channels, upload_interval,
+           upload_buffer, (unsigned long long)expected);
+    printf("%-8s %8s %10s %10s %8s %8s %10s\n", "backend", "requests", "bytes", "body", "B/req", "mallocs", "pulses");
+    int errors = 0;
+    errors += upload_run("metric", port, meter_upload_influx, "text/plain", 0, expected);
+    errors += upload_run("influx", port, meter_upload_influx, "text/plain", 60, expected);
+    errors += upload_run("json", port, meter_upload_json, "application/json", 60, expected);
+    errors += upload_run("influx h", port, meter_upload_influx, "text/plain", 3600, expected);
+    errors += upload_run("json h", port, meter_upload_json, "application/json", 3600, expected);
+    errors += upload_dst();
+
+    if (standin.record)
+        fclose(standin.record);
+    return errors != 0;
+}